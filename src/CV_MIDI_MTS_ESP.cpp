@@ -1,15 +1,90 @@
 #include "plugin.hpp"
 #include "libMTSClient.h"
+#include "MTSClientStats.hpp"
+#include "NoteTable.hpp"
+#include "MidiScheduler.hpp"
 
 
 struct MidiOutput : dsp::MidiGenerator<PORT_MAX_CHANNELS>, midi::Output {
+	MidiScheduler scheduler;
+	// Bytes per second the port can take, 0 if unlimited
+	float bandwidth = 0.f;
+	// Channel for the generator's messages instead of the port's, e.g. an MPE master channel, or -1
+	int masterChannel = -1;
+	float credit = 0.f;
+
 	void onMessage(const midi::Message &message) override {
-		Output::sendMessage(message);
+		midi::Message m = message;
+		// Apply the port's channel here as Output::sendMessage() would, so queued messages can be compared by channel
+		int c = (masterChannel >= 0) ? masterChannel : channel;
+		if (m.getStatus() != 0xf && c >= 0)
+			m.setChannel(c);
+		schedule(m);
 	}
 
 	void reset() {
 		Output::reset();
 		MidiGenerator::reset();
+		scheduler.clear();
+		credit = 0.f;
+	}
+
+	/** Sends on `channel` rather than the port's channel, as MPE needs. `value` is ignored for program change and
+	channel pressure, which only have one data byte. */
+	void sendChannelMessage(uint8_t status, uint8_t channel, uint8_t note, uint8_t value) {
+		midi::Message m;
+		m.setStatus(status);
+		m.setChannel(channel);
+		m.setNote(note);
+		if (status == 0xc || status == 0xd)
+			m.setSize(2);
+		else
+			m.setValue(value);
+		schedule(m);
+	}
+
+	void schedule(const midi::Message& message) {
+		MidiScheduler::Packet packet;
+		packet.size = std::min(message.getSize(), 3);
+		for (int i = 0; i < packet.size; i++)
+			packet.bytes[i] = message.bytes[i];
+		if (!scheduler.push(packet, frame)) {
+			credit -= packet.size;
+			sendPacket(packet);
+		}
+	}
+
+	void sendPacket(const MidiScheduler::Packet& packet) {
+		if (!outputDevice)
+			return;
+		midi::Message m;
+		m.setSize(packet.size);
+		for (int i = 0; i < packet.size; i++)
+			m.bytes[i] = packet.bytes[i];
+		m.setFrame(frame);
+		outputDevice->sendMessage(m);
+	}
+
+	/** Sends everything queued regardless of the bandwidth, e.g. before the port is reset */
+	void flushAll() {
+		scheduler.flush(INFINITY, frame, [&](const MidiScheduler::Packet& packet) {
+			sendPacket(packet);
+		});
+	}
+
+	/** Sends what the bandwidth allows. Call once per frame after all of the frame's messages. */
+	void flush(float sampleTime) {
+		auto send = [&](const MidiScheduler::Packet& packet) {
+			sendPacket(packet);
+		};
+		if (bandwidth <= 0.f) {
+			scheduler.flush(INFINITY, frame, send);
+			return;
+		}
+		// Allow no more than one message of headroom, so the port's rate is never exceeded for long
+		credit = std::min(credit + bandwidth * sampleTime, 3.f);
+		if (!scheduler.empty())
+			credit -= scheduler.flush(credit, frame, send);
 	}
 };
 
@@ -43,8 +118,67 @@ struct CV_MIDI_MTS_ESP : Module {
 
 	MidiOutput midiOutput;
 	dsp::Timer rateLimiterTimer;
+
+	enum OutputMode {
+		NOTE_MODE,
+		// Each voice on its own member channel of an MPE zone, with pitch bend for the residual between the input and
+		// the nearest note
+		MPE_MODE,
+		// Each voice on the note and channel MTS_FrequencyToNoteAndChannel() would pick, for multi-channel tunings
+		ROUTED_MODE,
+		NUM_OUTPUT_MODES
+	};
+	OutputMode outputMode;
+	enum MpeZone {
+		// Master channel 1, members from channel 2 up
+		MPE_LOWER_ZONE,
+		// Master channel 16, members from channel 15 down
+		MPE_UPPER_ZONE,
+		NUM_MPE_ZONES
+	};
+	MpeZone mpeZone;
+	// Member channel pitch bend range of the receiver, in semitones
+	float mpeBendRange;
+	// Smallest change of the residual in cents that sends a new bend
+	float mpeBendResolution;
+	// Member channels of a zone that has all 16 channels to itself
+	static const int MPE_VOICES = 15;
+	// What the receiver last heard for each voice in the modes that bypass the MIDI generator
+	bool voiceGates[16];
+	int voiceNotes[16];
+	int voiceChannels[16];
+	int voiceBends[16];
+	int voicePressures[16];
+	// Set by the UI thread, since messages may only be queued from the audio thread
+	std::atomic<bool> panicRequested;
 	
 	MTSClient *mtsClient = 0;
+	const MTSTuningCache* tuningCache = 0;
+	unsigned int tuningGeneration = 0;
+	dsp::ClockDivider tuningDivider;
+
+	// Pitch in volts of every note as MTS_FrequencyToNote() sees it, i.e. without filtered notes, sorted so that
+	// the nearest note is one binary search away
+	float noteVolts[128];
+	NoteTable noteTable;
+	// The same for every channel's table in ROUTED_MODE, indexed by channel * 128 + note. Rebuilt only when needed,
+	// one channel per frame into the table not in use, which is swapped in once complete.
+	float routeVolts[16 * 128];
+	bool routeEnabled[16 * 128];
+	TNoteTable<16 * 128> routeTables[2];
+	int routeTable = 0;
+	bool routeTableDirty = true;
+	// Next channel the rebuild adds, 16 to complete it, or -1 when idle
+	int routeBuildChannel = -1;
+	// Input range [cellLower, cellUpper) that maps to each channel's current note, so the table is only searched
+	// when the input leaves it. Empty when invalidated.
+	float cellLower[16];
+	float cellUpper[16];
+	int cellNotes[16];
+	// Conditioned values last handed to the MIDI generator in NOTE_MODE, -1 to resend
+	simd::float_4 lastVels[4];
+	simd::float_4 lastGates[4];
+	simd::float_4 lastAfts[4];
 
 	CV_MIDI_MTS_ESP() {
 		config(NUM_PARAMS, NUM_INPUTS, NUM_OUTPUTS, NUM_LIGHTS);
@@ -61,7 +195,17 @@ struct CV_MIDI_MTS_ESP : Module {
         configInput(STOP_INPUT, "Stop trigger");
         configInput(CONTINUE_INPUT, "Continue trigger");
         configLight(CONNECTED_LIGHT, "MTS-ESP Connected");
+		tuningDivider.setDivision(16);
+		panicRequested = false;
 		mtsClient = MTS_RegisterClient();
+		tuningCache = MTS_GetTuningCache(mtsClient);
+		tuningGeneration = MTS_GetTuningGeneration(mtsClient);
+		updateNoteTable();
+		// Build the first route table in one go, since nothing is playing yet
+		do {
+			updateRouteTable();
+		} while (routeBuildChannel >= 0);
+		resetVoices();
 		onReset();
 	}
 	
@@ -71,9 +215,103 @@ struct CV_MIDI_MTS_ESP : Module {
 
 
 	void onReset() override {
+		// Release what the receiver is still sounding on the current mode's channels before the mode and the port reset
+		releaseVoices();
+		midiOutput.flushAll();
+		outputMode = NOTE_MODE;
+		mpeZone = MPE_LOWER_ZONE;
+		midiOutput.bandwidth = 0.f;
+		mpeBendRange = 48.f;
+		mpeBendResolution = 1.f;
 		midiOutput.reset();
 	}
 
+	void resetVoices() {
+		for (int i = 0; i < 4; i++) {
+			lastVels[i] = -1.f;
+			lastGates[i] = -1.f;
+			lastAfts[i] = -1.f;
+		}
+		for (int c = 0; c < 16; c++) {
+			voiceGates[c] = false;
+			voiceNotes[c] = 0;
+			voiceChannels[c] = 0;
+			voiceBends[c] = -1;
+			voicePressures[c] = -1;
+		}
+	}
+
+	/** Also forgets the cells, since each output mode searches its own table, and in MPE mode tells the receiver
+	the zone and bend range again */
+	void panic() {
+		releaseVoices();
+		invalidateCells();
+		if (outputMode == MPE_MODE)
+			sendMpeConfig();
+	}
+
+	/** Queues note-offs for the generator's notes and for every voice sounding in the other modes */
+	void releaseVoices() {
+		midiOutput.panic();
+		for (int c = 0; c < 16; c++) {
+			if (voiceGates[c])
+				midiOutput.sendChannelMessage(0x8, voiceChannels[c], voiceNotes[c], 0);
+		}
+		resetVoices();
+	}
+
+	void setMpeBendRange(float mpeBendRange) {
+		if (mpeBendRange == this->mpeBendRange)
+			return;
+		this->mpeBendRange = mpeBendRange;
+		// Held voices were bent for the old range
+		panicRequested = true;
+	}
+
+	/** Sends the MPE configuration message on the master channel and the member pitch bend range on the first member
+	channel, which applies it to the whole zone */
+	void sendMpeConfig() {
+		sendRpn(mpeMasterChannel(), 6, MPE_VOICES, -1);
+		int semitones = (int) mpeBendRange;
+		int cents = clamp((int) std::round((mpeBendRange - semitones) * 100.f), 0, 99);
+		sendRpn(mpeChannel(0), 0, semitones, cents);
+	}
+
+	/** Sets registered parameter `rpn` and then deselects it, so stray data entry messages are ignored. `lsb` < 0 sends
+	the MSB only. */
+	void sendRpn(int channel, int rpn, int msb, int lsb) {
+		midiOutput.sendChannelMessage(0xb, channel, 101, rpn >> 7);
+		midiOutput.sendChannelMessage(0xb, channel, 100, rpn & 0x7f);
+		midiOutput.sendChannelMessage(0xb, channel, 6, msb);
+		if (lsb >= 0)
+			midiOutput.sendChannelMessage(0xb, channel, 38, lsb);
+		midiOutput.sendChannelMessage(0xb, channel, 101, 127);
+		midiOutput.sendChannelMessage(0xb, channel, 100, 127);
+	}
+
+	void setOutputMode(OutputMode outputMode) {
+		if (outputMode == this->outputMode)
+			return;
+		this->outputMode = outputMode;
+		panicRequested = true;
+	}
+
+	void setMpeZone(MpeZone mpeZone) {
+		if (mpeZone == this->mpeZone)
+			return;
+		this->mpeZone = mpeZone;
+		panicRequested = true;
+	}
+
+	int mpeMasterChannel() {
+		return (mpeZone == MPE_LOWER_ZONE) ? 0 : 15;
+	}
+
+	/** Member channel of voice c < MPE_VOICES, counting away from the master channel */
+	int mpeChannel(int c) {
+		return (mpeZone == MPE_LOWER_ZONE) ? 1 + c : 14 - c;
+	}
+
 	void process(const ProcessArgs& args) override {
 		
 		lights[CONNECTED_LIGHT].setBrightness(MTS_HasMaster(mtsClient) ? 1.f : 0.1f);
@@ -84,24 +322,40 @@ struct CV_MIDI_MTS_ESP : Module {
             rateLimiterTimer.time -= rateLimiterPeriod;
 
         midiOutput.setFrame(args.frame);
-        
-		for (int c = 0; c < inputs[PITCH_INPUT].getChannels(); c++) {
-			int vel = (int) std::round(inputs[VEL_INPUT].getNormalPolyVoltage(10.f * 100 / 127, c) / 10.f * 127);
-			vel = clamp(vel, 0, 127);
-			midiOutput.setVelocity(vel, c);
-
-            
-            double freq = 440. * pow(2., inputs[PITCH_INPUT].getVoltage(c) - 0.75);
-            int note;
-            if (mtsClient && MTS_HasMaster(mtsClient)) note = MTS_FrequencyToNote(mtsClient, freq, -1);
-            else note = (int) std::round(inputs[PITCH_INPUT].getVoltage(c) * 12.f + 60.f);
-			note = clamp(note, 0, 127);
-			bool gate = inputs[GATE_INPUT].getPolyVoltage(c) >= 1.f;
-			midiOutput.setNoteGate(note, gate, c);
+		// In MPE mode the port's channel is replaced by the zone's master channel
+		midiOutput.masterChannel = (outputMode == MPE_MODE) ? mpeMasterChannel() : -1;
+		if (panicRequested.exchange(false))
+			panic();
+
+		if (tuningDivider.process()) {
+			unsigned int generation = MTS_GetTuningGeneration(mtsClient);
+			if (generation != tuningGeneration) {
+				tuningGeneration = generation;
+				updateNoteTable();
+			}
+		}
 
-			int aft = (int) std::round(inputs[AFT_INPUT].getPolyVoltage(c) / 10.f * 127);
-			aft = clamp(aft, 0, 127);
-			midiOutput.setKeyPressure(aft, c);
+		if (outputMode == ROUTED_MODE)
+			updateRouteTable();
+
+		// Bend steps per cent, and the smallest step count worth sending
+		float bendScale = 8192.f / (mpeBendRange * 100.f);
+		int bendThreshold = (int) (mpeBendResolution * bendScale);
+
+		int channels = inputs[PITCH_INPUT].getChannels();
+		if (outputMode == NOTE_MODE) {
+			processNoteChannels(channels);
+		}
+		else {
+			if (outputMode == MPE_MODE) {
+				// Voices beyond the zone's member channels are not sent
+				for (int c = 0; c < std::min(channels, (int) MPE_VOICES); c++)
+					processMpeVoice(c, bendScale, bendThreshold);
+			}
+			else {
+				for (int c = 0; c < channels; c++)
+					processRoutedVoice(c);
+			}
 		}
 
         if (rateLimiterTriggered) {
@@ -133,20 +387,229 @@ struct CV_MIDI_MTS_ESP : Module {
 
 		bool cont = inputs[CONTINUE_INPUT].getVoltage() >= 1.f;
 		midiOutput.setContinue(cont);
+
+		midiOutput.flush(args.sampleTime);
 	}
     
+	/** Conditions four channels per pass and hands only the lanes whose note, gate, velocity or pressure changed to
+	the MIDI generator, which keeps the rest of its state */
+	void processNoteChannels(int channels) {
+		for (int c = 0; c < channels; c += 4) {
+			int lanes = (1 << std::min(channels - c, 4)) - 1;
+
+			simd::float_4 pitch = inputs[PITCH_INPUT].getVoltageSimd<simd::float_4>(c);
+			simd::float_4 inside = (pitch >= simd::float_4::load(&cellLower[c])) & (pitch < simd::float_4::load(&cellUpper[c]));
+			int outside = ~simd::movemask(inside) & lanes;
+			for (int k = 0; k < 4; k++) {
+				if (outside & (1 << k))
+					noteTable.quantize(pitch[k], NoteTable::ROUND_NEAREST, cellLower[c + k], cellUpper[c + k], cellNotes[c + k]);
+			}
+
+			simd::float_4 vel = inputs[VEL_INPUT].getNormalPolyVoltageSimd<simd::float_4>(10.f * 100 / 127, c);
+			vel = simd::clamp(simd::round(vel * (127 / 10.f)), 0.f, 127.f);
+			simd::float_4 gate = simd::ifelse(inputs[GATE_INPUT].getPolyVoltageSimd<simd::float_4>(c) >= 1.f, 1.f, 0.f);
+			simd::float_4 aft = inputs[AFT_INPUT].getPolyVoltageSimd<simd::float_4>(c);
+			aft = simd::clamp(simd::round(aft * (127 / 10.f)), 0.f, 127.f);
+
+			int changed = simd::movemask((vel != lastVels[c / 4]) | (gate != lastGates[c / 4]) | (aft != lastAfts[c / 4]));
+			changed = (changed | outside) & lanes;
+			if (!changed)
+				continue;
+			for (int k = 0; k < 4; k++) {
+				if (!(changed & (1 << k)))
+					continue;
+				midiOutput.setVelocity((int) vel[k], c + k);
+				midiOutput.setNoteGate(cellNotes[c + k], gate[k] != 0.f, c + k);
+				midiOutput.setKeyPressure((int) aft[k], c + k);
+				lastVels[c / 4][k] = vel[k];
+				lastGates[c / 4][k] = gate[k];
+				lastAfts[c / 4][k] = aft[k];
+			}
+		}
+	}
+
+	/** While the gate is held the sounding note is kept and the input is followed with pitch bend, so glides across
+	notes don't retrigger the receiver. A new note is only started when the bend would leave the bend range. */
+	void processMpeVoice(int c, float bendScale, int bendThreshold) {
+		float pitch = inputs[PITCH_INPUT].getVoltage(c);
+		// Within the MIDI note range, so the bend arithmetic and its casts stay defined for any input
+		pitch = std::isfinite(pitch) ? clamp(pitch, -5.f, (127 - 60) / 12.f) : 0.f;
+		bool gate = inputs[GATE_INPUT].getPolyVoltage(c) >= 1.f;
+
+		if (!gate) {
+			if (voiceGates[c]) {
+				midiOutput.sendChannelMessage(0x8, voiceChannels[c], voiceNotes[c], 0);
+				voiceGates[c] = false;
+			}
+			return;
+		}
+
+		float bend = voiceGates[c] ? std::round(8192.f + (pitch - noteVolts[voiceNotes[c]]) * 1200.f * bendScale) : -1.f;
+		if (bend >= 0.f && bend <= 0x3fff) {
+			if (std::abs((int) bend - voiceBends[c]) > bendThreshold)
+				sendMpeBend(c, voiceChannels[c], (int) bend);
+		}
+		else {
+			if (!(pitch >= cellLower[c] && pitch < cellUpper[c]))
+				noteTable.quantize(pitch, NoteTable::ROUND_NEAREST, cellLower[c], cellUpper[c], cellNotes[c]);
+			int note = cellNotes[c];
+			float cents = (pitch - noteVolts[note]) * 1200.f;
+			int noteBend = clamp((int) std::round(8192.f + cents * bendScale), 0, 0x3fff);
+			int channel = mpeChannel(c);
+			if (voiceGates[c])
+				midiOutput.sendChannelMessage(0x8, voiceChannels[c], voiceNotes[c], 0);
+			// The bend has to arrive before the note so the attack is in tune
+			sendMpeBend(c, channel, noteBend);
+			int vel = (int) std::round(inputs[VEL_INPUT].getNormalPolyVoltage(10.f * 100 / 127, c) / 10.f * 127);
+			vel = clamp(vel, 1, 127);
+			midiOutput.sendChannelMessage(0x9, channel, note, vel);
+			voiceGates[c] = true;
+			voiceNotes[c] = note;
+			voiceChannels[c] = channel;
+		}
+
+		int aft = (int) std::round(inputs[AFT_INPUT].getPolyVoltage(c) / 10.f * 127);
+		aft = clamp(aft, 0, 127);
+		if (aft != voicePressures[c]) {
+			midiOutput.sendChannelMessage(0xd, voiceChannels[c], aft, 0);
+			voicePressures[c] = aft;
+		}
+	}
+
+	void processRoutedVoice(int c) {
+		float pitch = inputs[PITCH_INPUT].getVoltage(c);
+		if (!(pitch >= cellLower[c] && pitch < cellUpper[c]))
+			routeTables[routeTable].quantize(pitch, NoteTable::ROUND_NEAREST, cellLower[c], cellUpper[c], cellNotes[c]);
+		int note = cellNotes[c] & 127;
+		int channel = cellNotes[c] >> 7;
+		bool gate = inputs[GATE_INPUT].getPolyVoltage(c) >= 1.f;
+
+		if (gate && (!voiceGates[c] || note != voiceNotes[c] || channel != voiceChannels[c])) {
+			if (voiceGates[c])
+				midiOutput.sendChannelMessage(0x8, voiceChannels[c], voiceNotes[c], 0);
+			int vel = (int) std::round(inputs[VEL_INPUT].getNormalPolyVoltage(10.f * 100 / 127, c) / 10.f * 127);
+			vel = clamp(vel, 1, 127);
+			midiOutput.sendChannelMessage(0x9, channel, note, vel);
+			voiceGates[c] = true;
+			voiceNotes[c] = note;
+			voiceChannels[c] = channel;
+			voicePressures[c] = -1;
+		}
+		else if (!gate && voiceGates[c]) {
+			midiOutput.sendChannelMessage(0x8, voiceChannels[c], voiceNotes[c], 0);
+			voiceGates[c] = false;
+		}
+
+		if (gate) {
+			int aft = (int) std::round(inputs[AFT_INPUT].getPolyVoltage(c) / 10.f * 127);
+			aft = clamp(aft, 0, 127);
+			if (aft != voicePressures[c]) {
+				midiOutput.sendChannelMessage(0xa, channel, note, aft);
+				voicePressures[c] = aft;
+			}
+		}
+	}
+
+	void sendMpeBend(int c, int channel, int bend) {
+		midiOutput.sendChannelMessage(0xe, channel, bend & 0x7f, bend >> 7);
+		voiceBends[c] = bend;
+	}
+
     void processBypass(const ProcessArgs& args) override {
         lights[CONNECTED_LIGHT].setBrightness(MTS_HasMaster(mtsClient) ? 1.f : 0.1f);
         Module::processBypass(args);
     }
 
+	void invalidateCells() {
+		for (int c = 0; c < 16; c++) {
+			cellLower[c] = INFINITY;
+			cellUpper[c] = -INFINITY;
+		}
+	}
+
+	/** Rebuilds the note table from the tuning cache and forgets every channel's cell */
+	void updateNoteTable() {
+		bool enabled[128];
+		for (int i = 0; i < 128; i++) {
+			noteVolts[i] = std::log2(tuningCache->freqs[i] / dsp::FREQ_C4);
+			enabled[i] = !tuningCache->filtered[i];
+		}
+		noteTable.build(noteVolts, enabled);
+		routeTableDirty = true;
+		invalidateCells();
+	}
+
+	/** Merges the tables of every channel MTS_FrequencyToNoteAndChannel() would search, or only channel 0 if the
+	master uses no multi-channel tables. Each call adds one channel to the table not in use, so a rebuild never puts
+	2048 MTS-ESP queries and a 2048-entry sort into a single frame. A rebuild restarts if the tuning changes again. */
+	void updateRouteTable() {
+		TNoteTable<16 * 128>& table = routeTables[1 - routeTable];
+		if (routeTableDirty) {
+			routeTableDirty = false;
+			routeBuildChannel = 0;
+			table.beginBuild();
+		}
+		if (routeBuildChannel < 0)
+			return;
+
+		if (routeBuildChannel < 16) {
+			int channel = routeBuildChannel++;
+			unsigned short multiChannelMask = tuningCache->multiChannelMask;
+			bool multi = (multiChannelMask >> channel) & 1;
+			bool used = multiChannelMask ? multi : (channel == 0);
+			for (int note = 0; note < 128; note++) {
+				int i = channel * 128 + note;
+				// Channels without their own table are filtered and tuned like channel -1, which the cache holds
+				routeEnabled[i] = used && !(multi ? MTS_ShouldFilterNote(mtsClient, note, channel) : tuningCache->filtered[note]);
+				double freq = !used ? dsp::FREQ_C4 : multi ? MTS_NoteToFrequency(mtsClient, note, channel) : tuningCache->freqs[note];
+				routeVolts[i] = std::log2(freq / dsp::FREQ_C4);
+			}
+			table.addSources(routeVolts, routeEnabled, channel * 128, 128);
+			return;
+		}
+
+		table.finishBuild(routeVolts);
+		routeTable = 1 - routeTable;
+		routeBuildChannel = -1;
+		invalidateCells();
+	}
+
 	json_t* dataToJson() override {
 		json_t* rootJ = json_object();
+		json_object_set_new(rootJ, "outputMode", json_integer(outputMode));
+		json_object_set_new(rootJ, "mpeZone", json_integer(mpeZone));
+		json_object_set_new(rootJ, "bandwidth", json_real(midiOutput.bandwidth));
+		json_object_set_new(rootJ, "mpeBendRange", json_real(mpeBendRange));
+		json_object_set_new(rootJ, "mpeBendResolution", json_real(mpeBendResolution));
 		json_object_set_new(rootJ, "midi", midiOutput.toJson());
 		return rootJ;
 	}
 
 	void dataFromJson(json_t* rootJ) override {
+		json_t* outputModeJ = json_object_get(rootJ, "outputMode");
+		if (outputModeJ)
+			outputMode = (OutputMode) clamp((int) json_integer_value(outputModeJ), 0, NUM_OUTPUT_MODES - 1);
+
+		json_t* mpeZoneJ = json_object_get(rootJ, "mpeZone");
+		if (mpeZoneJ)
+			mpeZone = (MpeZone) clamp((int) json_integer_value(mpeZoneJ), 0, NUM_MPE_ZONES - 1);
+
+		json_t* bandwidthJ = json_object_get(rootJ, "bandwidth");
+		if (bandwidthJ)
+			midiOutput.bandwidth = json_number_value(bandwidthJ);
+
+		json_t* mpeBendRangeJ = json_object_get(rootJ, "mpeBendRange");
+		if (mpeBendRangeJ)
+			mpeBendRange = clamp((float) json_number_value(mpeBendRangeJ), 1.f, 96.f);
+
+		json_t* mpeBendResolutionJ = json_object_get(rootJ, "mpeBendResolution");
+		if (mpeBendResolutionJ)
+			mpeBendResolution = clamp((float) json_number_value(mpeBendResolutionJ), 0.f, 100.f);
+
+		// Configure the receiver for the loaded zone and bend range
+		if (outputMode == MPE_MODE)
+			panicRequested = true;
+
 		json_t* midiJ = json_object_get(rootJ, "midi");
 		if (midiJ)
 			midiOutput.fromJson(midiJ);
@@ -157,10 +620,164 @@ struct CV_MIDI_MTS_ESP : Module {
 struct CV_MIDI_MTS_ESPPanicItem : MenuItem {
 	CV_MIDI_MTS_ESP* module;
 	void onAction(const ActionEvent& e) override {
-		module->midiOutput.panic();
+		module->panicRequested = true;
+	}
+};
+
+struct OutputModeValueItem : MenuItem {
+	CV_MIDI_MTS_ESP* module;
+	CV_MIDI_MTS_ESP::OutputMode outputMode;
+	void onAction(const ActionEvent& e) override {
+		module->setOutputMode(outputMode);
+	}
+};
+
+
+struct OutputModeItem : MenuItem {
+	CV_MIDI_MTS_ESP* module;
+	Menu* createChildMenu() override {
+		Menu* menu = new Menu;
+		std::vector<std::string> outputModeNames = {
+			"Notes",
+			"Microtonal MPE",
+			"MTS-ESP note and channel",
+		};
+		for (int i = 0; i < CV_MIDI_MTS_ESP::NUM_OUTPUT_MODES; i++) {
+			CV_MIDI_MTS_ESP::OutputMode outputMode = (CV_MIDI_MTS_ESP::OutputMode) i;
+			OutputModeValueItem* item = new OutputModeValueItem;
+			item->text = outputModeNames[i];
+			item->rightText = CHECKMARK(module->outputMode == outputMode);
+			item->module = module;
+			item->outputMode = outputMode;
+			menu->addChild(item);
+		}
+		return menu;
+	}
+};
+
+
+struct MpeZoneValueItem : MenuItem {
+	CV_MIDI_MTS_ESP* module;
+	CV_MIDI_MTS_ESP::MpeZone mpeZone;
+	void onAction(const ActionEvent& e) override {
+		module->setMpeZone(mpeZone);
 	}
 };
 
+
+struct MpeZoneItem : MenuItem {
+	CV_MIDI_MTS_ESP* module;
+	Menu* createChildMenu() override {
+		Menu* menu = new Menu;
+		std::vector<std::string> mpeZoneNames = {
+			"Lower (master channel 1)",
+			"Upper (master channel 16)",
+		};
+		for (int i = 0; i < CV_MIDI_MTS_ESP::NUM_MPE_ZONES; i++) {
+			CV_MIDI_MTS_ESP::MpeZone mpeZone = (CV_MIDI_MTS_ESP::MpeZone) i;
+			MpeZoneValueItem* item = new MpeZoneValueItem;
+			item->text = mpeZoneNames[i];
+			item->rightText = CHECKMARK(module->mpeZone == mpeZone);
+			item->module = module;
+			item->mpeZone = mpeZone;
+			menu->addChild(item);
+		}
+		return menu;
+	}
+};
+
+
+struct MpeBendRangeValueItem : MenuItem {
+	CV_MIDI_MTS_ESP* module;
+	float mpeBendRange;
+	void onAction(const ActionEvent& e) override {
+		module->setMpeBendRange(mpeBendRange);
+	}
+};
+
+
+struct MpeBendRangeItem : MenuItem {
+	CV_MIDI_MTS_ESP* module;
+	Menu* createChildMenu() override {
+		Menu* menu = new Menu;
+		std::vector<float> ranges = {2.f, 12.f, 24.f, 48.f, 96.f};
+		for (size_t i = 0; i < ranges.size(); i++) {
+			MpeBendRangeValueItem* item = new MpeBendRangeValueItem;
+			item->text = string::f("%g semitones", ranges[i]);
+			item->rightText = CHECKMARK(module->mpeBendRange == ranges[i]);
+			item->module = module;
+			item->mpeBendRange = ranges[i];
+			menu->addChild(item);
+		}
+		return menu;
+	}
+};
+
+
+struct MpeBendResolutionValueItem : MenuItem {
+	CV_MIDI_MTS_ESP* module;
+	float mpeBendResolution;
+	void onAction(const ActionEvent& e) override {
+		module->mpeBendResolution = mpeBendResolution;
+	}
+};
+
+
+struct MpeBendResolutionItem : MenuItem {
+	CV_MIDI_MTS_ESP* module;
+	Menu* createChildMenu() override {
+		Menu* menu = new Menu;
+		std::vector<float> resolutions = {0.f, 0.1f, 0.5f, 1.f, 2.f, 5.f};
+		std::vector<std::string> resolutionNames = {"Every change", "0.1 cents", "0.5 cents", "1 cent", "2 cents", "5 cents"};
+		for (size_t i = 0; i < resolutions.size(); i++) {
+			MpeBendResolutionValueItem* item = new MpeBendResolutionValueItem;
+			item->text = resolutionNames[i];
+			item->rightText = CHECKMARK(module->mpeBendResolution == resolutions[i]);
+			item->module = module;
+			item->mpeBendResolution = resolutions[i];
+			menu->addChild(item);
+		}
+		return menu;
+	}
+};
+
+
+struct BandwidthValueItem : MenuItem {
+	CV_MIDI_MTS_ESP* module;
+	float bandwidth;
+	void onAction(const ActionEvent& e) override {
+		module->midiOutput.bandwidth = bandwidth;
+	}
+};
+
+
+struct BandwidthItem : MenuItem {
+	CV_MIDI_MTS_ESP* module;
+	Menu* createChildMenu() override {
+		Menu* menu = new Menu;
+		// 31250 baud with 10 bits per byte for DIN MIDI
+		std::vector<float> bandwidths = {0.f, 3125.f, 2 * 3125.f, 4 * 3125.f};
+		std::vector<std::string> bandwidthNames = {"Unlimited", "DIN MIDI (3125 bytes/s)", "2x DIN MIDI", "4x DIN MIDI"};
+		for (size_t i = 0; i < bandwidths.size(); i++) {
+			BandwidthValueItem* item = new BandwidthValueItem;
+			item->text = bandwidthNames[i];
+			item->rightText = CHECKMARK(module->midiOutput.bandwidth == bandwidths[i]);
+			item->module = module;
+			item->bandwidth = bandwidths[i];
+			menu->addChild(item);
+		}
+		menu->addChild(new MenuSeparator);
+		const MidiScheduler& scheduler = module->midiOutput.scheduler;
+		menu->addChild(createMenuLabel(string::f("Sent: %llu", (unsigned long long) scheduler.sent.load(std::memory_order_relaxed))));
+		menu->addChild(createMenuLabel(string::f("Coalesced: %llu", (unsigned long long) scheduler.coalesced.load(std::memory_order_relaxed))));
+		menu->addChild(createMenuLabel(string::f("Dropped: %llu", (unsigned long long) scheduler.dropped.load(std::memory_order_relaxed))));
+		float sampleRate = APP->engine->getSampleRate();
+		menu->addChild(createMenuLabel(string::f("Max note delay: %.2f ms", scheduler.maxNoteDelay.load(std::memory_order_relaxed) * 1000.f / sampleRate)));
+		return menu;
+	}
+};
+
+
 struct CV_MIDI_MTS_ESP_MidiDisplay : MidiDisplay {
 	void setMidiPort(midi::Port* port) {
 		MidiDisplay::setMidiPort(port);
@@ -209,10 +826,46 @@ struct CV_MIDI_MTS_ESPWidget : ModuleWidget {
 
         menu->addChild(new MenuSeparator);
 
+		OutputModeItem* outputModeItem = new OutputModeItem;
+		outputModeItem->text = "Output mode";
+		outputModeItem->rightText = RIGHT_ARROW;
+		outputModeItem->module = module;
+		menu->addChild(outputModeItem);
+
+		BandwidthItem* bandwidthItem = new BandwidthItem;
+		bandwidthItem->text = "Output bandwidth";
+		bandwidthItem->rightText = RIGHT_ARROW;
+		bandwidthItem->module = module;
+		menu->addChild(bandwidthItem);
+
+		MpeZoneItem* mpeZoneItem = new MpeZoneItem;
+		mpeZoneItem->text = "MPE zone";
+		mpeZoneItem->rightText = RIGHT_ARROW;
+		mpeZoneItem->module = module;
+		menu->addChild(mpeZoneItem);
+
+		MpeBendRangeItem* mpeBendRangeItem = new MpeBendRangeItem;
+		mpeBendRangeItem->text = "MPE bend range";
+		mpeBendRangeItem->rightText = RIGHT_ARROW;
+		mpeBendRangeItem->module = module;
+		menu->addChild(mpeBendRangeItem);
+
+		MpeBendResolutionItem* mpeBendResolutionItem = new MpeBendResolutionItem;
+		mpeBendResolutionItem->text = "MPE bend resolution";
+		mpeBendResolutionItem->rightText = RIGHT_ARROW;
+		mpeBendResolutionItem->module = module;
+		menu->addChild(mpeBendResolutionItem);
+
 		CV_MIDI_MTS_ESPPanicItem* panicItem = new CV_MIDI_MTS_ESPPanicItem;
 		panicItem->text = "Panic";
 		panicItem->module = module;
 		menu->addChild(panicItem);
+
+		MTSClientStatsItem* statsItem = new MTSClientStatsItem;
+		statsItem->text = "MTS-ESP statistics";
+		statsItem->rightText = RIGHT_ARROW;
+		statsItem->mtsClient = module->mtsClient;
+		menu->addChild(statsItem);
 	}
 };
 
@@ -0,0 +1,66 @@
+#pragma once
+#include <cstdint>
+
+
+/** Set of held MIDI notes in press order.
+A doubly linked list threaded through fixed per-note slots, plus a bitmap for membership, so pressing, releasing
+and finding the most recent note are O(1) and nothing is allocated on the audio thread.
+*/
+struct HeldNotes {
+	static const uint8_t NONE = 0xff;
+
+	uint64_t held[2] = {};
+	// Neighbours of each held note in press order
+	uint8_t prev[128];
+	uint8_t next[128];
+	uint8_t first = NONE;
+	uint8_t last = NONE;
+
+	bool empty() const {
+		return last == NONE;
+	}
+
+	bool contains(uint8_t note) const {
+		note &= 127;
+		return (held[note >> 6] >> (note & 63)) & 1;
+	}
+
+	/** The most recently pressed note which is still held. Only valid if not empty(). */
+	uint8_t back() const {
+		return last;
+	}
+
+	/** Adds the note as the most recent, moving it to the end if it was already held */
+	void press(uint8_t note) {
+		note &= 127;
+		release(note);
+		held[note >> 6] |= (uint64_t) 1 << (note & 63);
+		prev[note] = last;
+		next[note] = NONE;
+		if (last != NONE)
+			next[last] = note;
+		else
+			first = note;
+		last = note;
+	}
+
+	void release(uint8_t note) {
+		note &= 127;
+		if (!contains(note))
+			return;
+		held[note >> 6] &= ~((uint64_t) 1 << (note & 63));
+		if (prev[note] != NONE)
+			next[prev[note]] = next[note];
+		else
+			first = next[note];
+		if (next[note] != NONE)
+			prev[next[note]] = prev[note];
+		else
+			last = prev[note];
+	}
+
+	void clear() {
+		held[0] = held[1] = 0;
+		first = last = NONE;
+	}
+};
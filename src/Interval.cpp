@@ -54,8 +54,8 @@ struct Interval : Module {
 	float ratioNum = 2.f;
 	float ratioDen = 1.f;
 	float ratioVolts = 1.f;
-	float transposeCvs[16];
-	float bendCvs[16];
+	simd::float_4 transposeCvs[4];
+	simd::float_4 bendCvs[4];
 	int cvTranspose = 0;
 	
 	Interval() {
@@ -78,29 +78,25 @@ struct Interval : Module {
 	virtual ~Interval() {
 	}
 	
-	void getCvs(Input &input, float *cvs) {
-	 	int channels = input.getChannels();
- 		if (channels == 0) {
- 			for (int i = 0; i < 16; i++)
-				cvs[i] = 1.f;
+	static simd::float_4 sanitize(simd::float_4 v) {
+		// NaN and infinity both fail the comparison
+		return simd::ifelse(simd::fabs(v) < INFINITY, v, 0.f);
+	}
+
+	/** CVs as a fraction of 5V: 1 if unpatched, the same for every channel if mono, and 1 past the end of a poly cable */
+	void getCvs(Input &input, simd::float_4 *cvs, int blocks) {
+		int channels = input.getChannels();
+		for (int c = 0; c < 4 * blocks; c += 4) {
+			if (channels == 0) {
+				cvs[c / 4] = 1.f;
+				continue;
+			}
+			simd::float_4 vin = simd::clamp(sanitize(input.getPolyVoltageSimd<simd::float_4>(c)), -5.f, 5.f) * 0.2f;
+			if (channels > 1)
+				vin = simd::ifelse(simd::float_4(c, c + 1, c + 2, c + 3) < channels, vin, 1.f);
+			cvs[c / 4] = vin;
 		}
- 		else if (channels == 1) {
- 			float vin = input.getVoltage(0);
- 			if (std::isnan(vin) || std::isinf(vin)) vin = 0.f;
- 			vin = clamp(vin, -5.f, 5.f) * 0.2f;
- 			for (int i = 0; i < 16; i++)
- 				cvs[i] = vin;
- 		}
- 		else {
- 		 	for (int i = 0; i < channels; i++) {
-				float vin = input.getVoltage(0);
- 				if (std::isnan(vin) || std::isinf(vin)) vin = 0.f;
- 				cvs[i] = clamp(vin, -5.f, 5.f) * 0.2f;
- 			}
- 			for (int i = channels; i < 16; i++)
- 				cvs[i] = 1.f;
- 		}
- 	}
+	}
 
 	void process(const ProcessArgs& args) override {	
 		bool newUseCents = !(params[INTERVAL_MODE_PARAM].getValue());
@@ -122,21 +118,22 @@ struct Interval : Module {
  			intervalVolts = ratioVolts;
  		else
  			intervalVolts = params[CENTS_PARAM].getValue() / 1200.f;
- 		
- 		getCvs(inputs[TRANSPOSE_INPUT], transposeCvs);
-		getCvs(inputs[BEND_INPUT], bendCvs);
- 		cvTranspose = std::round(params[TRANSPOSE_PARAM].getValue()) * transposeCvs[0];
- 		
- 		int channels = inputs[CV_IN_INPUT].getChannels();
- 		for (int c = 0; c < channels; c++) {
-			double vin = inputs[CV_IN_INPUT].getVoltage(c);
-			if (std::isnan(vin) || std::isinf(vin)) vin = 0.f;	
-			outputs[THRU_OUTPUT].setVoltage(vin, c);
-			int tranpose = std::round(params[TRANSPOSE_PARAM].getValue()) * transposeCvs[c];
-			float bend = params[BEND_PARAM].getValue() * bendCvs[c];
-			float off = intervalVolts * (tranpose + bend);
-			double vout = clamp(vin + off, -5.f, 5.f);
-			outputs[CV_OUT_OUTPUT].setVoltage(vout, c);
+
+		float transpose = std::round(params[TRANSPOSE_PARAM].getValue());
+		float bend = params[BEND_PARAM].getValue();
+		int channels = inputs[CV_IN_INPUT].getChannels();
+		// The display shows the first channel's transpose even without a pitch input
+		int blocks = std::max((channels + 3) / 4, 1);
+		getCvs(inputs[TRANSPOSE_INPUT], transposeCvs, blocks);
+		getCvs(inputs[BEND_INPUT], bendCvs, blocks);
+		cvTranspose = transpose * transposeCvs[0][0];
+
+		for (int c = 0; c < channels; c += 4) {
+			simd::float_4 vin = sanitize(inputs[CV_IN_INPUT].getVoltageSimd<simd::float_4>(c));
+			outputs[THRU_OUTPUT].setVoltageSimd(vin, c);
+			// Transpose is a whole number of intervals, truncated toward zero
+			simd::float_4 off = intervalVolts * (simd::trunc(transpose * transposeCvs[c / 4]) + bend * bendCvs[c / 4]);
+			outputs[CV_OUT_OUTPUT].setVoltageSimd(simd::clamp(vin + off, -5.f, 5.f), c);
 		}
 		outputs[THRU_OUTPUT].setChannels(channels);
 		outputs[CV_OUT_OUTPUT].setChannels(channels);
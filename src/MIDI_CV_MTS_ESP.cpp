@@ -1,5 +1,10 @@
 #include "plugin.hpp"
 #include "libMTSClient.h"
+#include "libMTSClientCache.hpp"
+#include "MTSClientStats.hpp"
+#include "MidiTimingStats.hpp"
+#include "HeldNotes.hpp"
+#include "VoiceAllocator.hpp"
 #include <algorithm>
 
 
@@ -31,6 +36,7 @@ struct MIDI_CV_MTS_ESP : Module {
 	};
 
 	midi::InputQueue midiInput;
+	MidiTimingStats timingStats;
 
     bool smooth;
 	int channels;
@@ -42,6 +48,8 @@ struct MIDI_CV_MTS_ESP : Module {
 		NUM_POLY_MODES
 	};
 	PolyMode polyMode;
+	// Which busy channel a new note takes over when all are busy
+	VoiceAllocator::StealPolicy stealPolicy;
 
 	uint32_t clock = 0;
 	int clockDivision;
@@ -52,15 +60,20 @@ struct MIDI_CV_MTS_ESP : Module {
 	bool gates[16];
 	uint8_t velocities[16];
 	uint8_t aftertouches[16];
-	std::vector<uint8_t> heldNotes;
+	HeldNotes heldNotes;
+	VoiceAllocator voiceAllocator;
 
 	int rotateIndex;
 
 	// 16 channels for MPE. When MPE is disabled, only the first channel is used.
 	uint16_t pitches[16];
 	uint8_t mods[16];
-	dsp::ExponentialFilter pitchFilters[16];
-	dsp::ExponentialFilter modFilters[16];
+	// Wheel positions as -1..1 and 0..1, filtered four channels at a time. A group whose outputs have reached
+	// their targets is skipped, so idle controllers cost almost nothing.
+	simd::float_4 pitchTargets[4];
+	simd::float_4 modTargets[4];
+	dsp::TExponentialFilter<simd::float_4> pitchFilters[4];
+	dsp::TExponentialFilter<simd::float_4> modFilters[4];
 
 	dsp::PulseGenerator clockPulse;
 	dsp::PulseGenerator clockDividerPulse;
@@ -69,7 +82,25 @@ struct MIDI_CV_MTS_ESP : Module {
 	dsp::PulseGenerator stopPulse;
 	dsp::PulseGenerator continuePulse;
 
+	// Retuning in semitones of each channel's note. When the tuning changes, held notes glide
+	// from their current retuning to the new target instead of jumping.
+	float retuneGlide;
+	// Pitch bend range in semitones summed into the CV output in MPE mode, 0 to keep bend on its own output only
+	float mpeBendRange;
+	simd::float_4 retunes[4];
+	simd::float_4 retuneTargets[4];
+	bool retuneGliding = false;
+	// MIDI channel each channel's note was received on in MPE mode, so multi-channel tunings apply, otherwise -1
+	int8_t midiChannels[16];
+	// Pitch output of each channel, only recomputed when its note or retuning changes
+	simd::float_4 voltages[4];
+	unsigned int tuningGeneration = 0;
+	dsp::ClockDivider tuningDivider;
+	// Set by the UI thread, since the MTS-ESP client may only be queried from the audio thread
+	std::atomic<bool> panicRequested;
+
 	MTSClient *mtsClient = 0;
+	const MTSTuningCache* tuningCache = 0;
 
 	MIDI_CV_MTS_ESP() {
 		config(NUM_PARAMS, NUM_INPUTS, NUM_OUTPUTS, NUM_LIGHTS);
@@ -86,12 +117,14 @@ struct MIDI_CV_MTS_ESP : Module {
         configOutput(STOP_OUTPUT, "Stop trigger");
         configOutput(CONTINUE_OUTPUT, "Continue trigger");
         configLight(CONNECTED_LIGHT, "MTS-ESP connected");
-		heldNotes.reserve(128);
-		for (int c = 0; c < 16; c++) {
-			pitchFilters[c].setTau(1 / 30.f);
-			modFilters[c].setTau(1 / 30.f);
+		for (int i = 0; i < 4; i++) {
+			pitchFilters[i].setTau(1 / 30.f);
+			modFilters[i].setTau(1 / 30.f);
 		}
+		tuningDivider.setDivision(16);
+		panicRequested = false;
 		mtsClient = MTS_RegisterClient();
+		tuningCache = MTS_GetTuningCache(mtsClient);
 		onReset();
 	}
 	
@@ -103,7 +136,10 @@ struct MIDI_CV_MTS_ESP : Module {
         smooth = true;
 		channels = 1;
 		polyMode = ROTATE_MODE;
+		stealPolicy = VoiceAllocator::STEAL_DEFAULT;
 		clockDivision = 24;
+		retuneGlide = 0.f;
+		mpeBendRange = 0.f;
 		panic();
 		midiInput.reset();
 	}
@@ -111,15 +147,18 @@ struct MIDI_CV_MTS_ESP : Module {
 	/** Resets performance state */
 	void panic() {
 		pedal = false;
+		voiceAllocator.reset(channels, 60);
 		for (int c = 0; c < 16; c++) {
-			notes[c] = 60;
+			setNote(c, 60);
 			gates[c] = false;
 			velocities[c] = 0;
 			aftertouches[c] = 0;
-			pitches[c] = 8192;
-			mods[c] = 0;
-			pitchFilters[c].reset();
-			modFilters[c].reset();
+			setPitch(c, 8192);
+			setMod(c, 0);
+		}
+		for (int i = 0; i < 4; i++) {
+			pitchFilters[i].reset();
+			modFilters[i].reset();
 		}
 		pedal = false;
 		rotateIndex = -1;
@@ -129,48 +168,66 @@ struct MIDI_CV_MTS_ESP : Module {
 	void process(const ProcessArgs& args) override {
 	
 		lights[CONNECTED_LIGHT].setBrightness(MTS_HasMaster(mtsClient) ? 1.f : 0.1f);
+
+		if (panicRequested.exchange(false))
+			panic();
 		
 		midi::Message msg;
+		uint32_t messages = 0;
+		uint32_t queued = 0;
 		while (midiInput.tryPop(&msg, args.frame)) {
+			if (messages++ == 0)
+				queued = midiInput.size() + 1;
+			if (msg.getFrame() >= 0)
+				timingStats.recordMessage(args.frame - msg.getFrame());
 			processMessage(msg);
 		}
+		if (messages)
+			timingStats.recordFrame(messages, queued);
+
+		if (tuningDivider.process()) {
+			unsigned int generation = MTS_GetTuningGeneration(mtsClient);
+			if (generation != tuningGeneration) {
+				tuningGeneration = generation;
+				updateRetuneTargets();
+			}
+		}
+		if (retuneGliding)
+			processRetuneGlide(args.sampleTime);
+
+		int wheelChannels = (polyMode == MPE_MODE) ? 16 : 1;
+		outputs[PITCH_OUTPUT].setChannels(wheelChannels);
+		outputs[MOD_OUTPUT].setChannels(wheelChannels);
+		for (int c = 0; c < wheelChannels; c += 4) {
+			processWheel(pitchFilters[c / 4], pitchTargets[c / 4], args.sampleTime);
+			outputs[PITCH_OUTPUT].setVoltageSimd(pitchFilters[c / 4].out * 5.f, c);
+			processWheel(modFilters[c / 4], modTargets[c / 4], args.sampleTime);
+			outputs[MOD_OUTPUT].setVoltageSimd(modFilters[c / 4].out * 10.f, c);
+		}
 
+		// In MPE mode each channel's bend can be added to its pitch, in volts per unit of bend
+		float bendScale = (polyMode == MPE_MODE) ? mpeBendRange / 12.f : 0.f;
 		outputs[CV_OUTPUT].setChannels(channels);
 		outputs[GATE_OUTPUT].setChannels(channels);
 		outputs[VELOCITY_OUTPUT].setChannels(channels);
 		outputs[AFTERTOUCH_OUTPUT].setChannels(channels);
 		outputs[RETRIGGER_OUTPUT].setChannels(channels);
+		for (int c = 0; c < channels; c += 4) {
+			simd::float_4 pitch = voltages[c / 4];
+			if (bendScale != 0.f)
+				pitch += pitchFilters[c / 4].out * bendScale;
+			outputs[CV_OUTPUT].setVoltageSimd(pitch, c);
+			simd::float_4 gate(gates[c], gates[c + 1], gates[c + 2], gates[c + 3]);
+			outputs[GATE_OUTPUT].setVoltageSimd(gate * 10.f, c);
+			simd::float_4 velocity(velocities[c], velocities[c + 1], velocities[c + 2], velocities[c + 3]);
+			outputs[VELOCITY_OUTPUT].setVoltageSimd(velocity * (10.f / 127.f), c);
+			simd::float_4 aftertouch(aftertouches[c], aftertouches[c + 1], aftertouches[c + 2], aftertouches[c + 3]);
+			outputs[AFTERTOUCH_OUTPUT].setVoltageSimd(aftertouch * (10.f / 127.f), c);
+		}
 		for (int c = 0; c < channels; c++) {
-			float note = notes[c];
-            if (mtsClient) note += MTS_RetuningInSemitones(mtsClient, notes[c], -1);
-			outputs[CV_OUTPUT].setVoltage((note - 60.f) / 12.f, c);
-			outputs[GATE_OUTPUT].setVoltage(gates[c] ? 10.f : 0.f, c);
-			outputs[VELOCITY_OUTPUT].setVoltage(rescale(velocities[c], 0, 127, 0.f, 10.f), c);
-			outputs[AFTERTOUCH_OUTPUT].setVoltage(rescale(aftertouches[c], 0, 127, 0.f, 10.f), c);
 			outputs[RETRIGGER_OUTPUT].setVoltage(retriggerPulses[c].process(args.sampleTime) ? 10.f : 0.f, c);
 		}
 
-        int wheelChannels = (polyMode == MPE_MODE) ? 16 : 1;
-        outputs[PITCH_OUTPUT].setChannels(wheelChannels);
-        outputs[MOD_OUTPUT].setChannels(wheelChannels);
-        for (int c = 0; c < wheelChannels; c++) {
-            float pw = ((int) pitches[c] - 8192) / 8191.f;
-            pw = clamp(pw, -1.f, 1.f);
-            if (smooth)
-                pw = pitchFilters[c].process(args.sampleTime, pw);
-            else
-                pitchFilters[c].out = pw;
-            outputs[PITCH_OUTPUT].setVoltage(pw * 5.f);
-            
-            float mod = mods[c] / 127.f;
-            mod = clamp(mod, 0.f, 1.f);
-            if (smooth)
-                mod = modFilters[c].process(args.sampleTime, mod);
-            else
-                modFilters[c].out = mod;
-            outputs[MOD_OUTPUT].setVoltage(mod * 10.f);
-        }
-
 		outputs[CLOCK_OUTPUT].setVoltage(clockPulse.process(args.sampleTime) ? 10.f : 0.f);
 		outputs[CLOCK_DIV_OUTPUT].setVoltage(clockDividerPulse.process(args.sampleTime) ? 10.f : 0.f);
 		outputs[START_OUTPUT].setVoltage(startPulse.process(args.sampleTime) ? 10.f : 0.f);
@@ -183,6 +240,75 @@ struct MIDI_CV_MTS_ESP : Module {
         Module::processBypass(args);
     }
 
+	void processWheel(dsp::TExponentialFilter<simd::float_4>& filter, simd::float_4 target, float sampleTime) {
+		// The filter snaps to its input once a step underflows, so settled lanes compare equal
+		if (!simd::movemask(filter.out != target))
+			return;
+		if (smooth)
+			filter.process(sampleTime, target);
+		else
+			filter.out = target;
+	}
+
+	void setPitch(int c, uint16_t pitch) {
+		pitches[c] = pitch;
+		pitchTargets[c / 4][c % 4] = clamp(((int) pitch - 8192) / 8191.f, -1.f, 1.f);
+	}
+
+	void setMod(int c, uint8_t mod) {
+		mods[c] = mod;
+		modTargets[c / 4][c % 4] = clamp(mod / 127.f, 0.f, 1.f);
+	}
+
+	/** Sets the note of a channel and jumps straight to its retuning, since only held notes should glide */
+	void setNote(int c, uint8_t note, int midiChannel = -1) {
+		notes[c] = note;
+		voiceAllocator.setNote(c, note);
+		midiChannels[c] = midiChannel;
+		float retune = MTS_CachedRetuning<MTS_SEMITONES, MTS_PER_CHANNEL>(mtsClient, tuningCache, note, midiChannel);
+		retunes[c / 4][c % 4] = retune;
+		retuneTargets[c / 4][c % 4] = retune;
+		voltages[c / 4][c % 4] = (note + retune - 60.f) / 12.f;
+	}
+
+	void updateVoltages() {
+		for (int i = 0; i < 4; i++) {
+			simd::float_4 note(notes[4 * i], notes[4 * i + 1], notes[4 * i + 2], notes[4 * i + 3]);
+			voltages[i] = (note + retunes[i] - 60.f) / 12.f;
+		}
+	}
+
+	void updateRetuneTargets() {
+		for (int c = 0; c < 16; c++)
+			retuneTargets[c / 4][c % 4] = MTS_CachedRetuning<MTS_SEMITONES, MTS_PER_CHANNEL>(mtsClient, tuningCache, notes[c], midiChannels[c]);
+		if (retuneGlide > 0.f) {
+			retuneGliding = true;
+		}
+		else {
+			for (int i = 0; i < 4; i++)
+				retunes[i] = retuneTargets[i];
+			updateVoltages();
+		}
+	}
+
+	void processRetuneGlide(float sampleTime) {
+		float lambda = std::min(sampleTime / retuneGlide, 1.f);
+		bool settled = true;
+		for (int i = 0; i < 4; i++) {
+			simd::float_4 delta = retuneTargets[i] - retunes[i];
+			retunes[i] += delta * lambda;
+			if (simd::movemask(simd::fabs(delta) > 1e-4f))
+				settled = false;
+		}
+		// Snap to the targets once every channel is within 0.01 cents
+		if (settled) {
+			for (int i = 0; i < 4; i++)
+				retunes[i] = retuneTargets[i];
+			retuneGliding = false;
+		}
+		updateVoltages();
+	}
+
 	void processMessage(midi::Message msg) {
 		// DEBUG("MIDI: %01x %01x %02x %02x", msg.getStatus(), msg.getChannel(), msg.getNote(), msg.getValue());
 
@@ -195,9 +321,9 @@ struct MIDI_CV_MTS_ESP : Module {
 			case 0x9: {
                 int c = msg.getChannel();
                 if (msg.getValue() > 0) {
-                    if (!MTS_ShouldFilterNote(mtsClient, msg.getNote(), -1)) {
-                        pressNote(msg.getNote(), &c);
-                        velocities[c] = msg.getValue();
+                    int midiChannel = (polyMode == MPE_MODE) ? c : -1;
+                    if (!MTS_CachedShouldFilterNote<MTS_PER_CHANNEL>(mtsClient, tuningCache, msg.getNote(), midiChannel)) {
+                        pressNote(msg.getNote(), msg.getValue(), &c);
                     }
 				}
 				else {
@@ -234,7 +360,7 @@ struct MIDI_CV_MTS_ESP : Module {
 			// pitch wheel
 			case 0xe: {
 				int c = (polyMode == MPE_MODE) ? msg.getChannel() : 0;
-				pitches[c] = ((uint16_t) msg.getValue() << 7) | msg.getNote();
+				setPitch(c, ((uint16_t) msg.getValue() << 7) | msg.getNote());
 			} break;
 			case 0xf: {
 				processSystem(msg);
@@ -248,7 +374,7 @@ struct MIDI_CV_MTS_ESP : Module {
 			// mod
 			case 0x01: {
 				int c = (polyMode == MPE_MODE) ? msg.getChannel() : 0;
-				mods[c] = msg.getValue();
+				setMod(c, msg.getValue());
 			} break;
 			// sustain
 			case 0x40: {
@@ -302,20 +428,19 @@ struct MIDI_CV_MTS_ESP : Module {
 		switch (polyMode) {
 			case REUSE_MODE: {
 				// Find channel with the same note
-				for (int c = 0; c < channels; c++) {
-					if (notes[c] == note)
-						return c;
-				}
+				uint16_t same = voiceAllocator.withNote(note);
+				if (same)
+					return VoiceAllocator::lowestBit(same);
 			} // fallthrough
 
 			case ROTATE_MODE: {
 				// Find next available channel
-				for (int i = 0; i < channels; i++) {
-					rotateIndex++;
-					if (rotateIndex >= channels)
-						rotateIndex = 0;
-					if (!gates[rotateIndex])
-						return rotateIndex;
+				int c = voiceAllocator.nextFree(rotateIndex);
+				if (c < 0)
+					c = voiceAllocator.steal(stealPolicy, note);
+				if (c >= 0) {
+					rotateIndex = c;
+					return c;
 				}
 				// No notes are available. Advance rotateIndex once more.
 				rotateIndex++;
@@ -325,11 +450,10 @@ struct MIDI_CV_MTS_ESP : Module {
 			} break;
 
 			case RESET_MODE: {
-				for (int c = 0; c < channels; c++) {
-					if (!gates[c])
-						return c;
-				}
-				return channels - 1;
+				int c = voiceAllocator.firstFree();
+				if (c < 0)
+					c = voiceAllocator.steal(stealPolicy, note);
+				return (c >= 0) ? c : channels - 1;
 			} break;
 
 			case MPE_MODE: {
@@ -341,13 +465,9 @@ struct MIDI_CV_MTS_ESP : Module {
 		}
 	}
 
-	void pressNote(uint8_t note, int* channel) {
-		// Remove existing similar note
-		auto it = std::find(heldNotes.begin(), heldNotes.end(), note);
-		if (it != heldNotes.end())
-			heldNotes.erase(it);
-		// Push note
-		heldNotes.push_back(note);
+	void pressNote(uint8_t note, uint8_t velocity, int* channel) {
+		// Push note, moving it to the end if already held
+		heldNotes.press(note);
 		// Determine actual channel
 		if (polyMode == MPE_MODE) {
 			// Channel is already decided for us
@@ -356,31 +476,35 @@ struct MIDI_CV_MTS_ESP : Module {
 			*channel = assignChannel(note);
 		}
 		// Set note
-		notes[*channel] = note;
+		if (polyMode == MPE_MODE)
+			setNote(*channel, note, *channel);
+		else
+			setNote(*channel, note);
 		gates[*channel] = true;
+		velocities[*channel] = velocity;
+		voiceAllocator.press(*channel, velocity);
 		retriggerPulses[*channel].trigger(1e-3);
 	}
 
 	void releaseNote(uint8_t note) {
 		// Remove the note
-		auto it = std::find(heldNotes.begin(), heldNotes.end(), note);
-		if (it != heldNotes.end())
-			heldNotes.erase(it);
+		heldNotes.release(note);
 		// Hold note if pedal is pressed
 		if (pedal)
 			return;
 		// Turn off gate of all channels with note
-		for (int c = 0; c < channels; c++) {
-			if (notes[c] == note) {
-				gates[c] = false;
-			}
+		for (uint16_t mask = voiceAllocator.withNote(note); mask; mask &= mask - 1) {
+			int c = VoiceAllocator::lowestBit(mask);
+			gates[c] = false;
+			voiceAllocator.release(c);
 		}
 		// Set last note if monophonic
 		if (channels == 1) {
 			if (note == notes[0] && !heldNotes.empty()) {
 				uint8_t lastNote = heldNotes.back();
-				notes[0] = lastNote;
+				setNote(0, lastNote);
 				gates[0] = true;
+				voiceAllocator.press(0, velocities[0]);
 				return;
 			}
 		}
@@ -400,21 +524,16 @@ struct MIDI_CV_MTS_ESP : Module {
 		if (channels == 1) {
 			if (!heldNotes.empty()) {
 				uint8_t lastNote = heldNotes.back();
-				notes[0] = lastNote;
+				setNote(0, lastNote);
 			}
 		}
 		// Clear notes that are not held if polyphonic
 		else {
-			for (int c = 0; c < channels; c++) {
+			for (uint16_t mask = voiceAllocator.busy & voiceAllocator.activeMask(); mask; mask &= mask - 1) {
+				int c = VoiceAllocator::lowestBit(mask);
+				gates[c] = heldNotes.contains(notes[c]);
 				if (!gates[c])
-					continue;
-				gates[c] = false;
-				for (uint8_t note : heldNotes) {
-					if (notes[c] == note) {
-						gates[c] = true;
-						break;
-					}
-				}
+					voiceAllocator.release(c);
 			}
 		}
 	}
@@ -423,14 +542,14 @@ struct MIDI_CV_MTS_ESP : Module {
 		if (channels == this->channels)
 			return;
 		this->channels = channels;
-		panic();
+		panicRequested = true;
 	}
 
 	void setPolyMode(PolyMode polyMode) {
 		if (polyMode == this->polyMode)
 			return;
 		this->polyMode = polyMode;
-		panic();
+		panicRequested = true;
 	}
 
 	json_t* dataToJson() override {
@@ -438,7 +557,10 @@ struct MIDI_CV_MTS_ESP : Module {
         json_object_set_new(rootJ, "smooth", json_boolean(smooth));
 		json_object_set_new(rootJ, "channels", json_integer(channels));
 		json_object_set_new(rootJ, "polyMode", json_integer(polyMode));
+		json_object_set_new(rootJ, "stealPolicy", json_integer(stealPolicy));
 		json_object_set_new(rootJ, "clockDivision", json_integer(clockDivision));
+		json_object_set_new(rootJ, "retuneGlide", json_real(retuneGlide));
+		json_object_set_new(rootJ, "mpeBendRange", json_real(mpeBendRange));
 		// Saving/restoring pitch and mod doesn't make much sense for MPE.
 		if (polyMode != MPE_MODE) {
 			json_object_set_new(rootJ, "lastPitch", json_integer(pitches[0]));
@@ -461,17 +583,32 @@ struct MIDI_CV_MTS_ESP : Module {
 		if (polyModeJ)
 			polyMode = (PolyMode) json_integer_value(polyModeJ);
 
+		json_t* stealPolicyJ = json_object_get(rootJ, "stealPolicy");
+		if (stealPolicyJ)
+			stealPolicy = (VoiceAllocator::StealPolicy) clamp((int) json_integer_value(stealPolicyJ), 0, VoiceAllocator::NUM_STEAL_POLICIES - 1);
+
 		json_t* clockDivisionJ = json_object_get(rootJ, "clockDivision");
 		if (clockDivisionJ)
 			clockDivision = json_integer_value(clockDivisionJ);
 
+		json_t* retuneGlideJ = json_object_get(rootJ, "retuneGlide");
+		if (retuneGlideJ)
+			retuneGlide = json_number_value(retuneGlideJ);
+
+		json_t* mpeBendRangeJ = json_object_get(rootJ, "mpeBendRange");
+		if (mpeBendRangeJ) {
+			// Off for anything that isn't a usable range
+			float range = json_number_value(mpeBendRangeJ);
+			mpeBendRange = std::isfinite(range) ? clamp(range, 0.f, 96.f) : 0.f;
+		}
+
 		json_t* lastPitchJ = json_object_get(rootJ, "lastPitch");
 		if (lastPitchJ)
-			pitches[0] = json_integer_value(lastPitchJ);
+			setPitch(0, json_integer_value(lastPitchJ));
 
 		json_t* lastModJ = json_object_get(rootJ, "lastMod");
 		if (lastModJ)
-			mods[0] = json_integer_value(lastModJ);
+			setMod(0, json_integer_value(lastModJ));
 
 		json_t* midiJ = json_object_get(rootJ, "midi");
 		if (midiJ)
@@ -508,6 +645,62 @@ struct ClockDivisionItem : MenuItem {
 };
 
 
+struct RetuneGlideValueItem : MenuItem {
+	MIDI_CV_MTS_ESP* module;
+	float retuneGlide;
+	void onAction(const ActionEvent& e) override {
+		module->retuneGlide = retuneGlide;
+	}
+};
+
+
+struct RetuneGlideItem : MenuItem {
+	MIDI_CV_MTS_ESP* module;
+	Menu* createChildMenu() override {
+		Menu* menu = new Menu;
+		std::vector<float> glides = {0.f, 0.005f, 0.01f, 0.02f, 0.05f, 0.1f, 0.2f};
+		std::vector<std::string> glideNames = {"Off", "5 ms", "10 ms", "20 ms", "50 ms", "100 ms", "200 ms"};
+		for (size_t i = 0; i < glides.size(); i++) {
+			RetuneGlideValueItem* item = new RetuneGlideValueItem;
+			item->text = glideNames[i];
+			item->rightText = CHECKMARK(module->retuneGlide == glides[i]);
+			item->module = module;
+			item->retuneGlide = glides[i];
+			menu->addChild(item);
+		}
+		return menu;
+	}
+};
+
+
+struct MpeBendRangeValueItem : MenuItem {
+	MIDI_CV_MTS_ESP* module;
+	float mpeBendRange;
+	void onAction(const ActionEvent& e) override {
+		module->mpeBendRange = mpeBendRange;
+	}
+};
+
+
+struct MpeBendRangeItem : MenuItem {
+	MIDI_CV_MTS_ESP* module;
+	Menu* createChildMenu() override {
+		Menu* menu = new Menu;
+		std::vector<float> ranges = {0.f, 2.f, 12.f, 24.f, 48.f, 96.f};
+		std::vector<std::string> rangeNames = {"Off", "2 semitones", "12 semitones", "24 semitones", "48 semitones", "96 semitones"};
+		for (size_t i = 0; i < ranges.size(); i++) {
+			MpeBendRangeValueItem* item = new MpeBendRangeValueItem;
+			item->text = rangeNames[i];
+			item->rightText = CHECKMARK(module->mpeBendRange == ranges[i]);
+			item->module = module;
+			item->mpeBendRange = ranges[i];
+			menu->addChild(item);
+		}
+		return menu;
+	}
+};
+
+
 struct ChannelValueItem : MenuItem {
 	MIDI_CV_MTS_ESP* module;
 	int channels;
@@ -570,10 +763,45 @@ struct PolyModeItem : MenuItem {
 };
 
 
+struct StealPolicyValueItem : MenuItem {
+	MIDI_CV_MTS_ESP* module;
+	VoiceAllocator::StealPolicy stealPolicy;
+	void onAction(const ActionEvent& e) override {
+		module->stealPolicy = stealPolicy;
+	}
+};
+
+
+struct StealPolicyItem : MenuItem {
+	MIDI_CV_MTS_ESP* module;
+	Menu* createChildMenu() override {
+		Menu* menu = new Menu;
+		std::vector<std::string> stealPolicyNames = {
+			"Polyphony mode default",
+			"Oldest",
+			"Quietest",
+			"Lowest",
+			"Highest",
+			"Same note",
+		};
+		for (int i = 0; i < VoiceAllocator::NUM_STEAL_POLICIES; i++) {
+			VoiceAllocator::StealPolicy stealPolicy = (VoiceAllocator::StealPolicy) i;
+			StealPolicyValueItem* item = new StealPolicyValueItem;
+			item->text = stealPolicyNames[i];
+			item->rightText = CHECKMARK(module->stealPolicy == stealPolicy);
+			item->module = module;
+			item->stealPolicy = stealPolicy;
+			menu->addChild(item);
+		}
+		return menu;
+	}
+};
+
+
 struct MIDI_CV_MTS_ESPPanicItem : MenuItem {
 	MIDI_CV_MTS_ESP* module;
 	void onAction(const ActionEvent& e) override {
-		module->panic();
+		module->panicRequested = true;
 	}
 };
 
@@ -634,6 +862,12 @@ struct MIDI_CV_MTS_ESPWidget : ModuleWidget {
 		clockDivisionItem->module = module;
 		menu->addChild(clockDivisionItem);
 
+		RetuneGlideItem* retuneGlideItem = new RetuneGlideItem;
+		retuneGlideItem->text = "Retune glide";
+		retuneGlideItem->rightText = RIGHT_ARROW;
+		retuneGlideItem->module = module;
+		menu->addChild(retuneGlideItem);
+
 		ChannelItem* channelItem = new ChannelItem;
 		channelItem->text = "Polyphony channels";
 		channelItem->rightText = string::f("%d", module->channels) + " " + RIGHT_ARROW;
@@ -646,10 +880,34 @@ struct MIDI_CV_MTS_ESPWidget : ModuleWidget {
 		polyModeItem->module = module;
 		menu->addChild(polyModeItem);
 
+		MpeBendRangeItem* mpeBendRangeItem = new MpeBendRangeItem;
+		mpeBendRangeItem->text = "MPE pitch bend in V/oct";
+		mpeBendRangeItem->rightText = RIGHT_ARROW;
+		mpeBendRangeItem->module = module;
+		menu->addChild(mpeBendRangeItem);
+
+		StealPolicyItem* stealPolicyItem = new StealPolicyItem;
+		stealPolicyItem->text = "Voice stealing";
+		stealPolicyItem->rightText = RIGHT_ARROW;
+		stealPolicyItem->module = module;
+		menu->addChild(stealPolicyItem);
+
 		MIDI_CV_MTS_ESPPanicItem* panicItem = new MIDI_CV_MTS_ESPPanicItem;
 		panicItem->text = "Panic";
 		panicItem->module = module;
 		menu->addChild(panicItem);
+
+		MidiTimingStatsItem* timingStatsItem = new MidiTimingStatsItem;
+		timingStatsItem->text = "MIDI timing";
+		timingStatsItem->rightText = RIGHT_ARROW;
+		timingStatsItem->stats = &module->timingStats;
+		menu->addChild(timingStatsItem);
+
+		MTSClientStatsItem* statsItem = new MTSClientStatsItem;
+		statsItem->text = "MTS-ESP statistics";
+		statsItem->rightText = RIGHT_ARROW;
+		statsItem->mtsClient = module->mtsClient;
+		menu->addChild(statsItem);
 	}
 };
 
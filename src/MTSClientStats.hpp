@@ -0,0 +1,36 @@
+#pragma once
+#include "plugin.hpp"
+#include "libMTSClient.h"
+
+
+/** Context menu readout of the MTS-ESP query statistics for a module's client and for the whole process */
+struct MTSClientStatsItem : MenuItem {
+	MTSClient* mtsClient;
+
+	static void appendStats(Menu* menu, const MTSClientStats& stats) {
+		menu->addChild(createMenuLabel(string::f("Note to frequency: %llu", stats.noteToFrequencyQueries)));
+		menu->addChild(createMenuLabel(string::f("Retuning as ratio: %llu", stats.retuningAsRatioQueries)));
+		menu->addChild(createMenuLabel(string::f("Retuning in semitones: %llu", stats.retuningInSemitonesQueries)));
+		menu->addChild(createMenuLabel(string::f("Should filter note: %llu", stats.shouldFilterNoteQueries)));
+		menu->addChild(createMenuLabel(string::f("Frequency to note: %llu", stats.frequencyToNoteQueries)));
+		menu->addChild(createMenuLabel(string::f("Tuning generation: %llu", stats.tuningGenerationQueries)));
+		unsigned long long lookups = stats.cacheHits + stats.cacheMisses;
+		menu->addChild(createMenuLabel(string::f("Cache hits/misses: %llu/%llu (%.1f%%)", stats.cacheHits, stats.cacheMisses, lookups ? 100.0 * stats.cacheHits / lookups : 0.0)));
+		menu->addChild(createMenuLabel(string::f("libMTS calls: %llu", stats.libraryCalls)));
+		menu->addChild(createMenuLabel(string::f("Frequency scans: %llu (%llu notes)", stats.frequencyToNoteScans, stats.frequencyToNoteScannedNotes)));
+		menu->addChild(createMenuLabel(string::f("SysEx bytes parsed: %llu", stats.sysExBytesParsed)));
+	}
+
+	Menu* createChildMenu() override {
+		Menu* menu = new Menu;
+		MTSClientStats stats;
+		MTS_GetClientStats(mtsClient, &stats);
+		menu->addChild(createMenuLabel("This module"));
+		appendStats(menu, stats);
+		menu->addChild(new MenuSeparator);
+		MTS_GetProcessStats(&stats);
+		menu->addChild(createMenuLabel("All modules"));
+		appendStats(menu, stats);
+		return menu;
+	}
+};
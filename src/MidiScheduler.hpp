@@ -0,0 +1,235 @@
+#pragma once
+#include <cstdint>
+#include <atomic>
+#include <algorithm>
+
+
+/** Outgoing MIDI queue that fits a byte budget, e.g. the 3125 bytes per second of a DIN port.
+Notes, and controllers that only mean something in sequence such as registered parameter numbers and data entry,
+are sent first and in order. Pitch bend, pressure and CC messages wait in that priority order, and a newer value
+for the same channel, key or controller replaces a waiting one instead of queueing behind it. System real-time
+messages bypass the queue. Note-offs are never dropped: if the queue is full they wait in a table with one entry per
+channel and key, and note-ons are dropped until it has drained, so no note-on can overtake the note-off before it.
+Everything is preallocated, so pushing and flushing never touch the heap.
+Only the audio thread pushes and flushes; the counters may be read from any thread.
+*/
+struct MidiScheduler {
+	struct Packet {
+		uint8_t bytes[3];
+		uint8_t size;
+	};
+
+	/** Latest packet per key, with the keys in the order they first became pending */
+	template <int N>
+	struct Slots {
+		Packet packets[N];
+		bool pending[N] = {};
+		uint16_t order[N];
+		int head = 0;
+		int count = 0;
+
+		/** Returns whether the packet replaced one that was still pending */
+		bool push(int key, const Packet& packet) {
+			packets[key] = packet;
+			if (pending[key])
+				return true;
+			pending[key] = true;
+			order[(head + count++) % N] = key;
+			return false;
+		}
+
+		const Packet* front() const {
+			return count ? &packets[order[head]] : NULL;
+		}
+
+		void pop() {
+			pending[order[head]] = false;
+			head = (head + 1) % N;
+			count--;
+		}
+
+		/** Takes the packet for `key` out of the queue, keeping the others in order */
+		bool take(int key, Packet* packet) {
+			if (!pending[key])
+				return false;
+			*packet = packets[key];
+			pending[key] = false;
+			int j = 0;
+			for (int i = 0; i < count; i++) {
+				uint16_t k = order[(head + i) % N];
+				if (k != key)
+					order[(head + j++) % N] = k;
+			}
+			count = j;
+			return true;
+		}
+
+		void clear() {
+			for (int i = 0; i < count; i++)
+				pending[order[(head + i) % N]] = false;
+			head = count = 0;
+		}
+	};
+
+	static const int NOTE_CAPACITY = 256;
+	Packet notes[NOTE_CAPACITY];
+	int64_t noteFrames[NOTE_CAPACITY];
+	int noteHead = 0;
+	int noteCount = 0;
+	// Note-offs that found the note queue full, by channel and key
+	Slots<16 * 128> noteOffs;
+	// Pitch bend by channel
+	Slots<16> bends;
+	// Key pressure by channel and key, then channel pressure by channel
+	Slots<16 * 128 + 16> pressures;
+	// Control change by channel and controller
+	Slots<16 * 128> ccs;
+
+	std::atomic<uint64_t> sent;
+	std::atomic<uint64_t> coalesced;
+	std::atomic<uint64_t> dropped;
+	// Longest a note message waited in the queue, in frames
+	std::atomic<uint32_t> maxNoteDelay;
+
+	MidiScheduler() {
+		resetStats();
+	}
+
+	static void add(std::atomic<uint64_t>& counter) {
+		counter.store(counter.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+	}
+
+	void resetStats() {
+		sent.store(0, std::memory_order_relaxed);
+		coalesced.store(0, std::memory_order_relaxed);
+		dropped.store(0, std::memory_order_relaxed);
+		maxNoteDelay.store(0, std::memory_order_relaxed);
+	}
+
+	void clear() {
+		noteHead = noteCount = 0;
+		noteOffs.clear();
+		bends.clear();
+		pressures.clear();
+		ccs.clear();
+	}
+
+	bool empty() const {
+		return !noteCount && !noteOffs.count && !bends.count && !pressures.count && !ccs.count;
+	}
+
+	void pushNote(const Packet& packet, int64_t frame) {
+		if (noteCount == NOTE_CAPACITY) {
+			add(dropped);
+			return;
+		}
+		int i = (noteHead + noteCount++) % NOTE_CAPACITY;
+		notes[i] = packet;
+		noteFrames[i] = frame;
+	}
+
+	static bool isNoteOff(const Packet& packet) {
+		uint8_t status = packet.bytes[0] >> 4;
+		return status == 0x8 || (status == 0x9 && packet.size >= 3 && packet.bytes[2] == 0);
+	}
+
+	void pushNoteOff(const Packet& packet, int64_t frame) {
+		if (noteOffs.count || noteCount == NOTE_CAPACITY) {
+			if (noteOffs.push((packet.bytes[0] & 0xf) * 128 + (packet.bytes[1] & 0x7f), packet))
+				add(coalesced);
+			return;
+		}
+		pushNote(packet, frame);
+	}
+
+	/** Queues a channel message. Returns false for system real-time and other messages the caller should send now. */
+	bool push(const Packet& packet, int64_t frame) {
+		uint8_t status = packet.bytes[0] >> 4;
+		int channel = packet.bytes[0] & 0xf;
+		bool replaced = false;
+		switch (status) {
+			case 0x8: {
+				pushNoteOff(packet, frame);
+			} break;
+			case 0x9: {
+				if (isNoteOff(packet)) {
+					pushNoteOff(packet, frame);
+					break;
+				}
+				// A waiting bend must keep arriving before the note it tunes, so make sure both fit
+				int needed = bends.pending[channel] ? 2 : 1;
+				if (noteOffs.count || noteCount + needed > NOTE_CAPACITY) {
+					add(dropped);
+					break;
+				}
+				Packet bend;
+				if (bends.take(channel, &bend))
+					pushNote(bend, frame);
+				pushNote(packet, frame);
+			} break;
+			case 0xe: {
+				replaced = bends.push(channel, packet);
+			} break;
+			case 0xa: {
+				replaced = pressures.push(channel * 128 + (packet.bytes[1] & 0x7f), packet);
+			} break;
+			case 0xd: {
+				replaced = pressures.push(16 * 128 + channel, packet);
+			} break;
+			case 0xb: {
+				int controller = packet.bytes[1] & 0x7f;
+				// (N)RPN select and data entry
+				if (controller == 6 || controller == 38 || (controller >= 96 && controller <= 101))
+					pushNote(packet, frame);
+				else
+					replaced = ccs.push(channel * 128 + controller, packet);
+			} break;
+			default: return false;
+		}
+		if (replaced)
+			add(coalesced);
+		return true;
+	}
+
+	/** Sends queued packets in priority order while they fit in `budget` bytes. Returns the bytes sent. */
+	template <typename F>
+	int flush(float budget, int64_t frame, F send) {
+		int bytes = 0;
+		while (noteCount && bytes + notes[noteHead].size <= budget) {
+			bytes += notes[noteHead].size;
+			send(notes[noteHead]);
+			uint32_t delay = (uint32_t) std::max(frame - noteFrames[noteHead], (int64_t) 0);
+			if (delay > maxNoteDelay.load(std::memory_order_relaxed))
+				maxNoteDelay.store(delay, std::memory_order_relaxed);
+			noteHead = (noteHead + 1) % NOTE_CAPACITY;
+			noteCount--;
+			add(sent);
+		}
+		if (noteCount)
+			return bytes;
+		bytes += flushSlots(noteOffs, budget - bytes, send);
+		if (noteOffs.count)
+			return bytes;
+		bytes += flushSlots(bends, budget - bytes, send);
+		if (bends.count)
+			return bytes;
+		bytes += flushSlots(pressures, budget - bytes, send);
+		if (pressures.count)
+			return bytes;
+		bytes += flushSlots(ccs, budget - bytes, send);
+		return bytes;
+	}
+
+	template <int N, typename F>
+	int flushSlots(Slots<N>& slots, float budget, F send) {
+		int bytes = 0;
+		const Packet* packet;
+		while ((packet = slots.front()) && bytes + packet->size <= budget) {
+			bytes += packet->size;
+			send(*packet);
+			slots.pop();
+			add(sent);
+		}
+		return bytes;
+	}
+};
@@ -0,0 +1,193 @@
+#pragma once
+#include "plugin.hpp"
+#include <atomic>
+
+
+/** How late MIDI messages are processed relative to their timestamps, and how many arrive in the same frame.
+Only the audio thread writes, so counters are accumulated with a relaxed load and store rather than a locked
+read-modify-write. The UI thread reads them with relaxed loads and may see slightly stale values; it asks for a
+reset instead of clearing the counters itself, which takes effect with the next message.
+*/
+struct MidiTimingStats {
+	static const int NUM_BUCKETS = 16;
+
+	// latencies[0] counts messages processed in the frame they were stamped with, latencies[k] those 2^(k-1) to
+	// 2^k - 1 frames late. The last bucket also holds anything later.
+	std::atomic<uint32_t> latencies[NUM_BUCKETS];
+	// batches[k] counts frames that processed 2^k to 2^(k+1) - 1 messages
+	std::atomic<uint32_t> batches[NUM_BUCKETS];
+	std::atomic<uint64_t> messages;
+	// Sums of latency and latency squared in frames, for the mean and jitter
+	std::atomic<uint64_t> latencySum;
+	std::atomic<uint64_t> latencySquares;
+	std::atomic<uint32_t> maxLatency;
+	// Most messages found in the queue at the start of a frame
+	std::atomic<uint32_t> maxQueued;
+	std::atomic<bool> resetRequested;
+
+	/** Plain copy of the counters for display and export */
+	struct Snapshot {
+		uint32_t latencies[NUM_BUCKETS];
+		uint32_t batches[NUM_BUCKETS];
+		uint64_t messages;
+		uint64_t latencySum;
+		uint64_t latencySquares;
+		uint32_t maxLatency;
+		uint32_t maxQueued;
+
+		double meanLatency() const {
+			return messages ? (double) latencySum / messages : 0.0;
+		}
+
+		/** Standard deviation of the latency in frames */
+		double jitter() const {
+			if (!messages)
+				return 0.0;
+			double mean = meanLatency();
+			return std::sqrt(std::max((double) latencySquares / messages - mean * mean, 0.0));
+		}
+
+		json_t* toJson(float sampleRate) const {
+			json_t* rootJ = json_object();
+			json_object_set_new(rootJ, "sampleRate", json_real(sampleRate));
+			json_object_set_new(rootJ, "messages", json_integer(messages));
+			json_object_set_new(rootJ, "meanLatency", json_real(meanLatency()));
+			json_object_set_new(rootJ, "jitter", json_real(jitter()));
+			json_object_set_new(rootJ, "maxLatency", json_integer(maxLatency));
+			json_object_set_new(rootJ, "maxQueued", json_integer(maxQueued));
+			json_t* latenciesJ = json_array();
+			json_t* batchesJ = json_array();
+			for (int k = 0; k < NUM_BUCKETS; k++) {
+				json_array_append_new(latenciesJ, json_integer(latencies[k]));
+				json_array_append_new(batchesJ, json_integer(batches[k]));
+			}
+			json_object_set_new(rootJ, "latencies", latenciesJ);
+			json_object_set_new(rootJ, "batches", batchesJ);
+			return rootJ;
+		}
+	};
+
+	MidiTimingStats() {
+		reset();
+	}
+
+	template <typename T>
+	static void add(std::atomic<T>& counter, T n = 1) {
+		counter.store(counter.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+	}
+
+	template <typename T>
+	static void raise(std::atomic<T>& counter, T n) {
+		if (n > counter.load(std::memory_order_relaxed))
+			counter.store(n, std::memory_order_relaxed);
+	}
+
+	/** Audio thread only */
+	void reset() {
+		for (int k = 0; k < NUM_BUCKETS; k++) {
+			latencies[k].store(0, std::memory_order_relaxed);
+			batches[k].store(0, std::memory_order_relaxed);
+		}
+		messages.store(0, std::memory_order_relaxed);
+		latencySum.store(0, std::memory_order_relaxed);
+		latencySquares.store(0, std::memory_order_relaxed);
+		maxLatency.store(0, std::memory_order_relaxed);
+		maxQueued.store(0, std::memory_order_relaxed);
+		resetRequested.store(false, std::memory_order_relaxed);
+	}
+
+	/** Audio thread. Clears the counters if the UI thread asked to, before anything new is recorded. */
+	void applyReset() {
+		if (resetRequested.load(std::memory_order_relaxed))
+			reset();
+	}
+
+	/** Audio thread, for each message with a timestamp */
+	void recordMessage(int64_t latency) {
+		applyReset();
+		uint32_t frames = (uint32_t) std::min(std::max(latency, (int64_t) 0), (int64_t) UINT32_MAX);
+		int bucket = frames ? std::min(32 - __builtin_clz(frames), NUM_BUCKETS - 1) : 0;
+		add(latencies[bucket]);
+		add(messages, (uint64_t) 1);
+		add(latencySum, (uint64_t) frames);
+		add(latencySquares, (uint64_t) frames * frames);
+		raise(maxLatency, frames);
+	}
+
+	/** Audio thread, once per frame that processed any messages */
+	void recordFrame(uint32_t count, uint32_t queued) {
+		applyReset();
+		add(batches[std::min(31 - __builtin_clz(count), NUM_BUCKETS - 1)]);
+		raise(maxQueued, queued);
+	}
+
+	Snapshot snapshot() const {
+		Snapshot s;
+		for (int k = 0; k < NUM_BUCKETS; k++) {
+			s.latencies[k] = latencies[k].load(std::memory_order_relaxed);
+			s.batches[k] = batches[k].load(std::memory_order_relaxed);
+		}
+		s.messages = messages.load(std::memory_order_relaxed);
+		s.latencySum = latencySum.load(std::memory_order_relaxed);
+		s.latencySquares = latencySquares.load(std::memory_order_relaxed);
+		s.maxLatency = maxLatency.load(std::memory_order_relaxed);
+		s.maxQueued = maxQueued.load(std::memory_order_relaxed);
+		return s;
+	}
+};
+
+
+/** Context menu readout of a module's MIDI timing, with reset and export to the clipboard as JSON */
+struct MidiTimingStatsItem : MenuItem {
+	MidiTimingStats* stats;
+
+	static std::string bucketName(int k, bool latency) {
+		int low = latency ? (k ? 1 << (k - 1) : 0) : 1 << k;
+		int high = latency ? (k ? (1 << k) - 1 : 0) : (1 << (k + 1)) - 1;
+		if (k == MidiTimingStats::NUM_BUCKETS - 1)
+			return string::f("%d+", low);
+		if (low == high)
+			return string::f("%d", low);
+		return string::f("%d-%d", low, high);
+	}
+
+	Menu* createChildMenu() override {
+		Menu* menu = new Menu;
+		MidiTimingStats::Snapshot s = stats->snapshot();
+		float sampleRate = APP->engine->getSampleRate();
+		float msPerFrame = 1000.f / sampleRate;
+		menu->addChild(createMenuLabel(string::f("Messages: %llu", (unsigned long long) s.messages)));
+		menu->addChild(createMenuLabel(string::f("Mean latency: %.2f ms", s.meanLatency() * msPerFrame)));
+		menu->addChild(createMenuLabel(string::f("Jitter: %.2f ms", s.jitter() * msPerFrame)));
+		menu->addChild(createMenuLabel(string::f("Max latency: %.2f ms", s.maxLatency * msPerFrame)));
+		menu->addChild(createMenuLabel(string::f("Max queued messages: %u", s.maxQueued)));
+
+		menu->addChild(new MenuSeparator);
+		menu->addChild(createMenuLabel("Latency (frames)"));
+		for (int k = 0; k < MidiTimingStats::NUM_BUCKETS; k++) {
+			if (s.latencies[k])
+				menu->addChild(createMenuLabel(string::f("%s: %u", bucketName(k, true).c_str(), s.latencies[k])));
+		}
+		menu->addChild(createMenuLabel("Messages per frame"));
+		for (int k = 0; k < MidiTimingStats::NUM_BUCKETS; k++) {
+			if (s.batches[k])
+				menu->addChild(createMenuLabel(string::f("%s: %u", bucketName(k, false).c_str(), s.batches[k])));
+		}
+
+		menu->addChild(new MenuSeparator);
+		MidiTimingStats* stats = this->stats;
+		menu->addChild(createMenuItem("Copy as JSON", "", [=]() {
+			json_t* rootJ = s.toJson(sampleRate);
+			char* text = json_dumps(rootJ, JSON_INDENT(2));
+			json_decref(rootJ);
+			if (text) {
+				glfwSetClipboardString(APP->window->win, text);
+				free(text);
+			}
+		}));
+		menu->addChild(createMenuItem("Reset", "", [=]() {
+			stats->resetRequested.store(true, std::memory_order_relaxed);
+		}));
+		return menu;
+	}
+};
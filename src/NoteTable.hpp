@@ -0,0 +1,151 @@
+#pragma once
+#include <rack.hpp>
+
+
+/** Shared by every table size, so a rounding mode can be passed to any of them */
+struct NoteRounding {
+	enum Rounding {
+		ROUND_DOWN,
+		ROUND_NEAREST,
+		ROUND_UP,
+		NUM_ROUNDINGS
+	};
+};
+
+
+/** Tuning table sorted by pitch in volts, with the decision boundaries for each rounding mode precomputed so that
+quantizing a voltage takes one fixed-length binary search and no transcendental functions.
+Rebuild it when the tuning or the set of enabled notes changes.
+N is the number of source entries and must be a power of two, e.g. 128 MIDI notes, or 16 channels of 128 notes.
+*/
+template <int N>
+struct TNoteTable : NoteRounding {
+	int size = 0;
+	// Pitch and source index (the MIDI note, for 128 entries) of each enabled note, sorted by pitch
+	float volts[N];
+	uint16_t notes[N];
+	// boundaries[r][i] is the lowest input that selects entry i + 1 rather than entry i.
+	// Padded with infinity so the search never needs a bounds check.
+	float boundaries[NUM_ROUNDINGS][N];
+	// Sources of the range being added, sorted before they are merged into notes
+	uint16_t run[N];
+
+	/** Builds the table from the pitch of every source entry. If none is enabled, everything quantizes to entry 0. */
+	void build(const float* noteVolts, const bool* enabled) {
+		beginBuild();
+		addSources(noteVolts, enabled, 0, N);
+		finishBuild(noteVolts);
+	}
+
+	/** Starts a build that adds the sources a range at a time, so a large table can be built over several calls
+	without any one of them sorting every entry. Quantizing is undefined until finishBuild(). */
+	void beginBuild() {
+		size = 0;
+	}
+
+	/** Sorts the enabled sources in [first, first + count) and merges them into those added so far.
+	noteVolts must hold the pitch of every source added since beginBuild(). */
+	void addSources(const float* noteVolts, const bool* enabled, int first, int count) {
+		// Ties go to the lower index, which keeps the order deterministic without the buffer a stable sort allocates
+		auto less = [&](uint16_t a, uint16_t b) {
+			return noteVolts[a] < noteVolts[b] || (noteVolts[a] == noteVolts[b] && a < b);
+		};
+		int start = size;
+		for (int i = first; i < first + count; i++) {
+			if (enabled[i])
+				run[size++ - start] = i;
+		}
+		int runSize = size - start;
+		std::sort(run, run + runSize, less);
+		// Merge from the back, so the entries already in place only move once
+		int i = start - 1;
+		int j = runSize - 1;
+		for (int k = size - 1; j >= 0; k--) {
+			if (i >= 0 && less(run[j], notes[i]))
+				notes[k] = notes[i--];
+			else
+				notes[k] = run[j--];
+		}
+	}
+
+	/** Completes a build, with the pitches the sources were added with */
+	void finishBuild(const float* noteVolts) {
+		for (int i = 0; i < size; i++)
+			volts[i] = noteVolts[notes[i]];
+		if (size == 0) {
+			notes[0] = 0;
+			volts[0] = noteVolts[0];
+		}
+
+		for (int r = 0; r < NUM_ROUNDINGS; r++) {
+			for (int i = 0; i < N; i++)
+				boundaries[r][i] = INFINITY;
+		}
+		for (int i = 0; i + 1 < size; i++) {
+			float lower = volts[i];
+			float upper = volts[i + 1];
+			// Down keeps the lower note until the input reaches the upper one
+			boundaries[ROUND_DOWN][i] = upper;
+			// Nearest switches at the midpoint, which in volts is the geometric mean of the frequencies
+			boundaries[ROUND_NEAREST][i] = (float) (0.5 * ((double) lower + upper));
+			// Up moves to the upper note as soon as the input exceeds the lower one
+			boundaries[ROUND_UP][i] = std::nextafter(lower, INFINITY);
+		}
+	}
+
+	/** Returns the index of the entry that `v` quantizes to */
+	int find(float v, Rounding rounding) const {
+		const float* b = boundaries[rounding];
+		int i = 0;
+		for (int step = N / 2; step > 0; step >>= 1) {
+			if (b[i + step - 1] <= v)
+				i += step;
+		}
+		return i;
+	}
+
+	float quantize(float v, Rounding rounding) const {
+		return volts[find(v, rounding)];
+	}
+
+	/** Also returns the input range [lower, upper) that quantizes to the same entry, and the entry's MIDI note */
+	float quantize(float v, Rounding rounding, float& lower, float& upper, int& note) const {
+		const float* b = boundaries[rounding];
+		int i = find(v, rounding);
+		lower = (i > 0) ? b[i - 1] : -INFINITY;
+		upper = b[i];
+		note = notes[i];
+		return volts[i];
+	}
+
+	/** Searches four voltages at once. Lanes step through the same levels, so only the loads are per lane. */
+	simd::int32_4 find(simd::float_4 v, Rounding rounding) const {
+		const float* b = boundaries[rounding];
+		simd::int32_4 i = 0;
+		for (int step = N / 2; step > 0; step >>= 1) {
+			simd::float_4 boundary(b[i[0] + step - 1], b[i[1] + step - 1], b[i[2] + step - 1], b[i[3] + step - 1]);
+			i = i + (simd::int32_4::cast(boundary <= v) & simd::int32_4(step));
+		}
+		return i;
+	}
+
+	simd::float_4 quantize(simd::float_4 v, Rounding rounding) const {
+		simd::int32_4 i = find(v, rounding);
+		return simd::float_4(volts[i[0]], volts[i[1]], volts[i[2]], volts[i[3]]);
+	}
+
+	/** Also returns the input range [lower, upper) of each lane's entry, and the entry's MIDI note */
+	simd::float_4 quantize(simd::float_4 v, Rounding rounding, simd::float_4& lower, simd::float_4& upper, simd::float_4& note) const {
+		const float* b = boundaries[rounding];
+		simd::int32_4 i = find(v, rounding);
+		for (int k = 0; k < 4; k++) {
+			lower[k] = (i[k] > 0) ? b[i[k] - 1] : -INFINITY;
+			upper[k] = b[i[k]];
+			note[k] = notes[i[k]];
+		}
+		return simd::float_4(volts[i[0]], volts[i[1]], volts[i[2]], volts[i[3]]);
+	}
+};
+
+
+typedef TNoteTable<128> NoteTable;
@@ -1,5 +1,8 @@
 #include "plugin.hpp"
 #include "libMTSClient.h"
+#include "libMTSClientCache.hpp"
+#include "MTSClientStats.hpp"
+#include "NoteTable.hpp"
 #include <algorithm>
 
 struct Quantizer_MTS_ESP : Module {
@@ -10,11 +13,14 @@ struct Quantizer_MTS_ESP : Module {
 	};
 	enum InputIds {
 		CV_IN_INPUT,
+		CLOCK_INPUT,
 		NUM_INPUTS
 	};
 	enum OutputIds {
 		CV_OUT_OUTPUT,
 		TRIGGER_OUTPUT,
+		NOTE_OUTPUT,
+		DEGREE_OUTPUT,
 		NUM_OUTPUTS
 	};
 	enum LightIds {
@@ -22,20 +28,53 @@ struct Quantizer_MTS_ESP : Module {
 		NUM_LIGHTS
 	};
 
-	dsp::PulseGenerator pulseGenerators[16];
+	// Remaining time of each channel's trigger pulse
+	float pulseTimes[16] = { 0.f };
+	// Note index and scale degree outputs of each channel's current output note
+	float noteOut[16] = { 0.f };
+	float degreeOut[16] = { 0.f };
+	// With the clock input patched, each channel's input as sampled on its last clock edge
+	dsp::TSchmittTrigger<simd::float_4> clockTriggers[4];
+	float heldIn[16] = { 0.f };
 
 	MTSClient *mtsClient = 0;
+	const MTSTuningCache* tuningCache = 0;
+	unsigned int tuningGeneration = 0;
+	dsp::ClockDivider tuningDivider;
 	
 	bool hasMaster = false;
     bool bypassed = false;
 	int roundingMode = 0;
     int mode = 0;
-	double freqs[128];
-	float cv_out[16];
-	float last_cv_in[16] = { 0.f };
+	// Range of search inputs (volts in Quant mode, semitones in Retune mode) that gives each channel's current output.
+	// Starts empty so the first sample always searches.
+	float cellLower[16];
+	float cellUpper[16];
+	// How far in volts the input must move past the edge of the current cell before the output changes
+	float hysteresis = 0.f;
 	float last_cv_out[16] = { 0.f };
+	// Low-CPU mode: minimum time in seconds between recomputes, or 0 to recompute whenever something changes
+	float rateLimit = 0.f;
 	float rateLimiterPhase = 0.f;
-	const double ln2 = 0.693147180559945309417;
+	// Pitch of every note in volts, and the enabled notes sorted by pitch for Quant mode
+	float noteVolts[128];
+	NoteTable noteTable;
+	// Scale degrees of the master's keyboard map that Quant mode may select. The map falls back to 12 notes from middle C.
+	bool degreeEnabled[128];
+	int mapSize = 12;
+	int mapStartKey = 60;
+	// Set when a menu change means every note table must be rebuilt
+	bool noteTablesDirty = false;
+	// Quantize poly channel c against MIDI channel c's tuning. Channels the master gives a multi-channel table get their
+	// own note table, built when first used and rebuilt only when that channel's tuning changes; the rest share noteTable.
+	bool multiChannel = false;
+	float channelNoteVolts[16][128];
+	NoteTable channelNoteTables[16];
+	// cache->channelGenerations[c] that channelNoteTables[c] was built for, 0 if never built
+	unsigned int channelTableGenerations[16] = { 0 };
+	// Per-channel loop for the current mode, rounding and connection state, see getKernel()
+	typedef void (Quantizer_MTS_ESP::*Kernel)(const ProcessArgs& args, int channels, bool freqsUpdated);
+	Kernel kernel;
 	
 	Quantizer_MTS_ESP() {
 		config(NUM_PARAMS, NUM_INPUTS, NUM_OUTPUTS, NUM_LIGHTS);
@@ -44,18 +83,38 @@ struct Quantizer_MTS_ESP : Module {
         configSwitch(MODE_PARAM, 0.f, 1.f, 1.f, "Mode", {"Retune", "Quant"});
         getParamQuantity(MODE_PARAM)->randomizeEnabled = false;
         configInput(CV_IN_INPUT, "1V/oct pitch");
+        configInput(CLOCK_INPUT, "Sample and hold clock");
         configOutput(CV_OUT_OUTPUT, "1V/oct pitch");
         configOutput(TRIGGER_OUTPUT, "Trigger");
+        configOutput(NOTE_OUTPUT, "MIDI note (1/12 V per note, 0 V = C4)");
+        configOutput(DEGREE_OUTPUT, "Scale degree (1/12 V per degree)");
         configLight(CONNECTED_LIGHT, "MTS-ESP Connected");
         configBypass(CV_IN_INPUT, CV_OUT_OUTPUT);
 		mtsClient = MTS_RegisterClient();
-		for (int i = 0; i < 128; i++) freqs[i] = 440. * pow(2., (i-69.) / 12.);
+		tuningCache = MTS_GetTuningCache(mtsClient);
+		tuningDivider.setDivision(16);
+		kernel = getKernel(mode, roundingMode, hasMaster);
+		for (int i = 0; i < 128; i++)
+			degreeEnabled[i] = true;
+		for (int c = 0; c < 16; c++) {
+			cellLower[c] = INFINITY;
+			cellUpper[c] = -INFINITY;
+		}
 	}
 	
 	virtual ~Quantizer_MTS_ESP() {
 		MTS_DeregisterClient(mtsClient);
 	}
 
+	void onReset() override {
+		rateLimit = 0.f;
+		hysteresis = 0.f;
+		multiChannel = false;
+		for (int i = 0; i < 128; i++)
+			degreeEnabled[i] = true;
+		noteTablesDirty = true;
+	}
+
 	void process(const ProcessArgs& args) override {
 		bool lastHasMaster = hasMaster;
 		hasMaster = mtsClient && MTS_HasMaster(mtsClient);
@@ -68,14 +127,18 @@ struct Quantizer_MTS_ESP : Module {
 
 		lights[CONNECTED_LIGHT].setBrightness(hasMaster ? 1.f : 0.1f);
 
+		// Outputs are only recomputed when the tuning, a param or a channel's input changes, so the rate limiter is
+		// only needed to cap CPU in low-CPU mode
 		bool throttle = false;
-		const float rateLimiterPeriod = 0.005f;
-		rateLimiterPhase += args.sampleTime / rateLimiterPeriod;
-		if (rateLimiterPhase >= 1.f) {
-			rateLimiterPhase -= 1.f;
-		}
-		else {
-			throttle = hasMaster && (hasMaster == lastHasMaster) && (roundingMode == lastRoundingMode) && (mode == lastMode) && !bypassed;
+		if (rateLimit > 0.f) {
+			rateLimiterPhase += args.sampleTime / rateLimit;
+			if (rateLimiterPhase >= 1.f) {
+				rateLimiterPhase -= 1.f;
+			}
+			else {
+				// Clock edges would be missed while throttled, and a clocked input is cheap anyway
+				throttle = hasMaster && (hasMaster == lastHasMaster) && (roundingMode == lastRoundingMode) && (mode == lastMode) && !bypassed && !inputs[CLOCK_INPUT].isConnected();
+			}
 		}
 
         bypassed = false;
@@ -83,87 +146,278 @@ struct Quantizer_MTS_ESP : Module {
 		int channels = inputs[CV_IN_INPUT].getChannels();
 
 		if (throttle) {
-			for (int c = 0; c < channels; c++) {
-				outputs[CV_OUT_OUTPUT].setVoltage(last_cv_out[c], c);
+			for (int c = 0; c < channels; c += 4) {
+				outputs[CV_OUT_OUTPUT].setVoltageSimd(simd::float_4::load(&last_cv_out[c]), c);
+				outputs[NOTE_OUTPUT].setVoltageSimd(simd::float_4::load(&noteOut[c]), c);
+				outputs[DEGREE_OUTPUT].setVoltageSimd(simd::float_4::load(&degreeOut[c]), c);
 			}
 		}
-		else if (hasMaster) {
-			
-			bool freqsUpdated = (hasMaster != lastHasMaster) || (roundingMode != lastRoundingMode) || (mode != lastMode);
-			for (int i = 0; i < 128; i++) {
-				double f = MTS_NoteToFrequency(mtsClient, i, -1);
-				if (f != freqs[i]) {
-					freqs[i] = MTS_NoteToFrequency(mtsClient, i, -1);
-					freqsUpdated = true;
+		else {
+			bool paramsChanged = (hasMaster != lastHasMaster) || (roundingMode != lastRoundingMode) || (mode != lastMode);
+			if (paramsChanged)
+				kernel = getKernel(mode, roundingMode, hasMaster);
+			(this->*kernel)(args, channels, paramsChanged);
+		}
+        
+		outputs[CV_OUT_OUTPUT].setChannels(channels);
+		outputs[TRIGGER_OUTPUT].setChannels(channels);
+		outputs[NOTE_OUTPUT].setChannels(channels);
+		outputs[DEGREE_OUTPUT].setChannels(channels);
+	}
+
+	static Kernel getKernel(int mode, int roundingMode, bool online) {
+		static const Kernel kernels[2][NoteTable::NUM_ROUNDINGS] = {
+			{
+				&Quantizer_MTS_ESP::processChannels<0, NoteTable::ROUND_DOWN, true>,
+				&Quantizer_MTS_ESP::processChannels<0, NoteTable::ROUND_NEAREST, true>,
+				&Quantizer_MTS_ESP::processChannels<0, NoteTable::ROUND_UP, true>,
+			},
+			{
+				&Quantizer_MTS_ESP::processChannels<1, NoteTable::ROUND_DOWN, true>,
+				&Quantizer_MTS_ESP::processChannels<1, NoteTable::ROUND_NEAREST, true>,
+				&Quantizer_MTS_ESP::processChannels<1, NoteTable::ROUND_UP, true>,
+			},
+		};
+		// Without a master the input is passed through, whatever the mode and rounding
+		if (!online)
+			return &Quantizer_MTS_ESP::processChannels<0, NoteTable::ROUND_NEAREST, false>;
+		return kernels[clamp(mode, 0, 1)][clamp(roundingMode + 1, 0, NoteTable::NUM_ROUNDINGS - 1)];
+	}
+
+	/** Per-channel loop, specialised for each mode (0 = Retune, 1 = Quant), rounding and connection state */
+	template <int MODE, NoteTable::Rounding ROUNDING, bool ONLINE>
+	void processChannels(const ProcessArgs& args, int channels, bool freqsUpdated) {
+		bool clocked = inputs[CLOCK_INPUT].isConnected();
+		if (!ONLINE) {
+			for (int c = 0; c < channels; c += 4) {
+				simd::float_4 vin = getInput(c, clocked);
+				outputs[CV_OUT_OUTPUT].setVoltageSimd(vin, c);
+				vin.store(&last_cv_out[c]);
+				// Report the nearest 12-TET note
+				updateNoteOutputs(c, simd::clamp(simd::floor(vin * 12.f + 60.5f), 0.f, 127.f), simd::float_4::mask());
+				outputs[NOTE_OUTPUT].setVoltageSimd(simd::float_4::load(&noteOut[c]), c);
+				outputs[DEGREE_OUTPUT].setVoltageSimd(simd::float_4::load(&degreeOut[c]), c);
+			}
+			return;
+		}
+
+		// In low-CPU mode every unthrottled sample is already rate limited
+		if (freqsUpdated || noteTablesDirty || rateLimit > 0.f || tuningDivider.process()) {
+			unsigned int generation = MTS_GetTuningGeneration(mtsClient);
+			bool mapChanged = updateMap();
+			if (generation != tuningGeneration || mapChanged || noteTablesDirty) {
+				tuningGeneration = generation;
+				if (mapChanged || noteTablesDirty) {
+					for (int c = 0; c < 16; c++)
+						channelTableGenerations[c] = 0;
 				}
+				noteTablesDirty = false;
+				updateNoteTable();
+				freqsUpdated = true;
 			}
+		}
+
+		// Retune mode searches in semitones
+		float h = (MODE == 1) ? hysteresis : hysteresis * 12.f;
+		int multiChannels = multiChannel ? tuningCache->multiChannelMask : 0;
 
-			for (int c = 0; c < channels; c++) {
-				double vin = inputs[CV_IN_INPUT].getVoltage(c);
-				if (std::isnan(vin) || std::isinf(vin)) vin = 0.f;
-				if (!freqsUpdated && vin==last_cv_in[c]) {
-					cv_out[c] = last_cv_out[c];
+		for (int c = 0; c < channels; c += 4) {
+			simd::float_4 vin = getInput(c, clocked);
+			simd::float_4 x = (MODE == 1) ? vin : vin * 12.f + 60.f;
+			// Only lanes in use, so unused channels never get a table
+			int multiLanes = (multiChannels >> c) & 0xf & ((1 << std::min(channels - c, 4)) - 1);
+			if (multiLanes)
+				updateChannelTables(c, multiLanes);
+			simd::float_4 lower = simd::float_4::load(&cellLower[c]);
+			simd::float_4 upper = simd::float_4::load(&cellUpper[c]);
+			simd::float_4 lastOut = simd::float_4::load(&last_cv_out[c]);
+			simd::float_4 out = lastOut;
+			// Only lanes whose input left their cell are updated, so the others keep their hysteresis
+			simd::float_4 outside = (x < lower - h) | (x >= upper + h);
+			if (freqsUpdated)
+				outside = simd::float_4::mask();
+			if (simd::movemask(outside)) {
+				simd::float_4 newLower, newUpper, newOut, newNote;
+				if (MODE == 1 && !multiLanes) {
+					newOut = noteTable.quantize(x, ROUNDING, newLower, newUpper, newNote);
 				}
-				else if (mode == 1) {
-					double freq = dsp::FREQ_C4 * pow(2., vin);
-					double qf = freq;
-					unsigned char iLower, iUpper; iLower=0; iUpper=0;
-					double dLower, dUpper; dLower=0; dUpper=0;
-					bool found = false;
-					for (int i = 0; i < 128; i++) {
-						if (MTS_ShouldFilterNote(mtsClient, i, -1)) continue;
-						double d = freqs[i] - freq;
-						if (abs(d) < 1e-7) {found = true; break;}
-						if (d < 0) {if (!dLower || d>dLower) {dLower = d; iLower = i;}}
-						else if (!dUpper || d<dUpper) {dUpper = d; iUpper = i;}
+				else if (MODE == 1) {
+					// Lanes with their own table can't share the search, so search each one separately
+					for (int k = 0; k < 4; k++) {
+						const NoteTable& table = (multiLanes & (1 << k)) ? channelNoteTables[c + k] : noteTable;
+						int note;
+						newOut[k] = table.quantize(x[k], ROUNDING, newLower[k], newUpper[k], note);
+						newNote[k] = note;
 					}
-					if (!found) {
-						if (!dLower) qf = freqs[iUpper];
-						else if (!dUpper || iLower==iUpper) qf = freqs[iLower];
-						else if (roundingMode == -1) qf = freqs[iLower];
-						else if (roundingMode == 1) qf = freqs[iUpper];
-						else {
-							double fLower = freqs[iLower];
-							double fUpper = freqs[iUpper];
-							double fmid = fLower * pow(2., 0.5 * (log(fUpper/fLower) / ln2));
-							qf = freq<fmid?fLower:fUpper;
-						}
-					}			
-					cv_out[c] = log(qf/dsp::FREQ_C4) / ln2;
 				}
-                else {
-                    double pitch = (vin * 12.) + 60.;
-                    int note;
-                    if (roundingMode == -1) note = std::floor(pitch);
-                    else if (roundingMode == 1) note = std::ceil(pitch);
-                    else note = std::round(pitch);
-                    note = std::min(std::max(0, note), 127);
-                    cv_out[c] = log(freqs[note]/dsp::FREQ_C4) / ln2;
-                }
-				
-				last_cv_in[c] = vin;
-				
-				outputs[CV_OUT_OUTPUT].setVoltage(cv_out[c], c);
-		
-				if (cv_out[c] != last_cv_out[c]) {
-					pulseGenerators[c].trigger(1e-3f);
-					last_cv_out[c] = cv_out[c];
+				else {
+					newNote = retune<ROUNDING>(x, newLower, newUpper);
+					for (int k = 0; k < 4; k++) {
+						const float* volts = (multiLanes & (1 << k)) ? channelNoteVolts[c + k] : noteVolts;
+						newOut[k] = volts[(int) newNote[k]];
+					}
 				}
-				bool pulse = pulseGenerators[c].process(args.sampleTime);
-				outputs[TRIGGER_OUTPUT].setVoltage((pulse ? 10.f : 0.f), c);
+				out = simd::ifelse(outside, newOut, lastOut);
+				simd::ifelse(outside, newLower, lower).store(&cellLower[c]);
+				simd::ifelse(outside, newUpper, upper).store(&cellUpper[c]);
+				updateNoteOutputs(c, newNote, outside);
 			}
+			out.store(&last_cv_out[c]);
+			outputs[CV_OUT_OUTPUT].setVoltageSimd(out, c);
+			outputs[NOTE_OUTPUT].setVoltageSimd(simd::float_4::load(&noteOut[c]), c);
+			outputs[DEGREE_OUTPUT].setVoltageSimd(simd::float_4::load(&degreeOut[c]), c);
+
+			simd::float_4 pulse = simd::float_4::load(&pulseTimes[c]);
+			pulse = simd::ifelse(out != lastOut, simd::fmax(pulse, 1e-3f), pulse);
+			outputs[TRIGGER_OUTPUT].setVoltageSimd(simd::ifelse(pulse > 0.f, 10.f, 0.f), c);
+			pulse = simd::fmax(pulse - args.sampleTime, 0.f);
+			pulse.store(&pulseTimes[c]);
+		}
+	}
+    
+	/** Sets the note index and scale degree outputs of the lanes in mask from their MIDI notes */
+	void updateNoteOutputs(int c, simd::float_4 note, simd::float_4 mask) {
+		simd::float_4 degree;
+		for (int k = 0; k < 4; k++)
+			degree[k] = getDegree((int) note[k]);
+		simd::ifelse(mask, (note - 60.f) / 12.f, simd::float_4::load(&noteOut[c])).store(&noteOut[c]);
+		simd::ifelse(mask, degree / 12.f, simd::float_4::load(&degreeOut[c])).store(&degreeOut[c]);
+	}
+
+	/** Replaces NaN and infinite voltages with 0 V */
+	static simd::float_4 sanitize(simd::float_4 v) {
+		return simd::ifelse(simd::fabs(v) < INFINITY, v, 0.f);
+	}
+
+	/** Reads the input of the block starting at channel c. If clocked, each channel is sampled on the rising edge of its
+	clock channel (or of the only one, if the clock is mono) and held in between, so its cell never changes between edges.
+	*/
+	simd::float_4 getInput(int c, bool clocked) {
+		simd::float_4 vin = sanitize(inputs[CV_IN_INPUT].getVoltageSimd<simd::float_4>(c));
+		if (!clocked)
+			return vin;
+		simd::float_4 triggered = clockTriggers[c / 4].process(inputs[CLOCK_INPUT].getPolyVoltageSimd<simd::float_4>(c));
+		simd::float_4 held = simd::ifelse(triggered, vin, simd::float_4::load(&heldIn[c]));
+		held.store(&heldIn[c]);
+		return held;
+	}
+
+	/** Retune mode: rounds the pitch in semitones to a 12-TET note in the given direction, whose retuned pitch is the
+	output. Also returns the range of pitches [lower, upper) that round to the same note.
+	*/
+	template <NoteTable::Rounding ROUNDING>
+	static simd::float_4 retune(simd::float_4 pitch, simd::float_4& lower, simd::float_4& upper) {
+		simd::float_4 note;
+		if (ROUNDING == NoteTable::ROUND_DOWN) {
+			note = simd::clamp(simd::floor(pitch), 0.f, 127.f);
+			lower = note;
+			upper = note + 1.f;
+		}
+		else if (ROUNDING == NoteTable::ROUND_UP) {
+			// Up selects the note for pitches in (note - 1, note], so both ends move up by one ulp. They are never
+			// negative, where stepping the bits up would move them down.
+			note = simd::clamp(simd::ceil(pitch), 0.f, 127.f);
+			lower = simd::float_4::cast(simd::int32_4::cast(note - 1.f) + 1);
+			upper = simd::float_4::cast(simd::int32_4::cast(note) + 1);
 		}
 		else {
-			for (int c = 0; c < channels; c++) {
-				double vin = inputs[CV_IN_INPUT].getVoltage(c);
-				if (std::isnan(vin) || std::isinf(vin)) vin = 0.f;
-				outputs[CV_OUT_OUTPUT].setVoltage(vin, c);
-				last_cv_in[c] = last_cv_out[c] = vin;
+			note = simd::clamp(simd::floor(pitch + 0.5f), 0.f, 127.f);
+			lower = note - 0.5f;
+			upper = note + 0.5f;
+		}
+		lower = simd::ifelse(note <= 0.f, -INFINITY, lower);
+		upper = simd::ifelse(note >= 127.f, INFINITY, upper);
+		return note;
+	}
+
+	/** Reads the master's keyboard map and returns whether it changed */
+	bool updateMap() {
+		int size = MTS_GetMapSize(mtsClient);
+		int startKey = MTS_GetMapStartKey(mtsClient);
+		if (size <= 0)
+			size = 12;
+		if (startKey < 0)
+			startKey = 60;
+		bool changed = (size != mapSize) || (startKey != mapStartKey);
+		mapSize = size;
+		mapStartKey = startKey;
+		return changed;
+	}
+
+	int getDegree(int note) {
+		return ((note - mapStartKey) % mapSize + mapSize) % mapSize;
+	}
+
+	/** Builds the tables of the lanes in the block starting at channel c that use a multi-channel tuning, if they are
+	missing or out of date. Rebuilt lanes have their cells cleared so they are searched again.
+	*/
+	void updateChannelTables(int c, int lanes) {
+		for (int k = 0; k < 4; k++) {
+			int channel = c + k;
+			if (!(lanes & (1 << k)) || channelTableGenerations[channel] == tuningCache->channelGenerations[channel])
+				continue;
+			bool enabled[128];
+			for (int i = 0; i < 128; i++) {
+				channelNoteVolts[channel][i] = std::log2(MTS_NoteToFrequency(mtsClient, i, channel) / dsp::FREQ_C4);
+				enabled[i] = !MTS_ShouldFilterNote(mtsClient, i, channel) && degreeEnabled[getDegree(i)];
 			}
+			channelNoteTables[channel].build(channelNoteVolts[channel], enabled);
+			channelTableGenerations[channel] = tuningCache->channelGenerations[channel];
+			cellLower[channel] = INFINITY;
+			cellUpper[channel] = -INFINITY;
+		}
+	}
+
+	/** Disabled scale degrees are left out of the table like filtered notes, so they cost nothing to search */
+	void updateNoteTable() {
+		bool enabled[128];
+		for (int i = 0; i < 128; i++) {
+			noteVolts[i] = std::log2(tuningCache->freqs[i] / dsp::FREQ_C4);
+			enabled[i] = !tuningCache->filtered[i] && degreeEnabled[getDegree(i)];
+		}
+		noteTable.build(noteVolts, enabled);
+	}
+    
+	json_t* dataToJson() override {
+		json_t* rootJ = json_object();
+		json_object_set_new(rootJ, "rateLimit", json_real(rateLimit));
+		json_object_set_new(rootJ, "hysteresis", json_real(hysteresis));
+		json_object_set_new(rootJ, "multiChannel", json_boolean(multiChannel));
+		json_t* disabledDegreesJ = json_array();
+		for (int i = 0; i < 128; i++) {
+			if (!degreeEnabled[i])
+				json_array_append_new(disabledDegreesJ, json_integer(i));
+		}
+		json_object_set_new(rootJ, "disabledDegrees", disabledDegreesJ);
+		return rootJ;
+	}
+
+	void dataFromJson(json_t* rootJ) override {
+		json_t* rateLimitJ = json_object_get(rootJ, "rateLimit");
+		if (rateLimitJ)
+			rateLimit = json_number_value(rateLimitJ);
+
+		json_t* hysteresisJ = json_object_get(rootJ, "hysteresis");
+		if (hysteresisJ)
+			hysteresis = json_number_value(hysteresisJ);
+
+		json_t* multiChannelJ = json_object_get(rootJ, "multiChannel");
+		if (multiChannelJ)
+			multiChannel = json_boolean_value(multiChannelJ);
+
+		json_t* disabledDegreesJ = json_object_get(rootJ, "disabledDegrees");
+		if (disabledDegreesJ) {
+			for (int i = 0; i < 128; i++)
+				degreeEnabled[i] = true;
+			size_t index;
+			json_t* degreeJ;
+			json_array_foreach(disabledDegreesJ, index, degreeJ) {
+				int degree = json_integer_value(degreeJ);
+				if (degree >= 0 && degree < 128)
+					degreeEnabled[degree] = false;
+			}
+			noteTablesDirty = true;
 		}
-        
-		outputs[CV_OUT_OUTPUT].setChannels(channels);
-		outputs[TRIGGER_OUTPUT].setChannels(channels);
 	}
     
     void processBypass(const ProcessArgs& args) override {
@@ -174,22 +428,173 @@ struct Quantizer_MTS_ESP : Module {
     }
 };
 
+struct RateLimitValueItem : MenuItem {
+	Quantizer_MTS_ESP* module;
+	float rateLimit;
+	void onAction(const ActionEvent& e) override {
+		module->rateLimit = rateLimit;
+	}
+};
+
+
+struct RateLimitItem : MenuItem {
+	Quantizer_MTS_ESP* module;
+	Menu* createChildMenu() override {
+		Menu* menu = new Menu;
+		std::vector<float> rateLimits = {0.f, 0.001f, 0.002f, 0.005f, 0.01f};
+		std::vector<std::string> rateLimitNames = {"Off", "1 ms", "2 ms", "5 ms", "10 ms"};
+		for (size_t i = 0; i < rateLimits.size(); i++) {
+			RateLimitValueItem* item = new RateLimitValueItem;
+			item->text = rateLimitNames[i];
+			item->rightText = CHECKMARK(module->rateLimit == rateLimits[i]);
+			item->module = module;
+			item->rateLimit = rateLimits[i];
+			menu->addChild(item);
+		}
+		return menu;
+	}
+};
+
+
+struct HysteresisValueItem : MenuItem {
+	Quantizer_MTS_ESP* module;
+	float hysteresis;
+	void onAction(const ActionEvent& e) override {
+		module->hysteresis = hysteresis;
+	}
+};
+
+
+struct HysteresisItem : MenuItem {
+	Quantizer_MTS_ESP* module;
+	Menu* createChildMenu() override {
+		Menu* menu = new Menu;
+		std::vector<float> cents = {0.f, 1.f, 2.f, 5.f, 10.f, 25.f};
+		std::vector<std::string> centsNames = {"Off", "1 cent", "2 cents", "5 cents", "10 cents", "25 cents"};
+		for (size_t i = 0; i < cents.size(); i++) {
+			HysteresisValueItem* item = new HysteresisValueItem;
+			item->text = centsNames[i];
+			item->rightText = CHECKMARK(module->hysteresis == cents[i] / 1200.f);
+			item->module = module;
+			item->hysteresis = cents[i] / 1200.f;
+			menu->addChild(item);
+		}
+		return menu;
+	}
+};
+
+
+struct DegreeValueItem : MenuItem {
+	Quantizer_MTS_ESP* module;
+	int degree;
+	void onAction(const ActionEvent& e) override {
+		module->degreeEnabled[degree] ^= true;
+		module->noteTablesDirty = true;
+	}
+	void step() override {
+		rightText = CHECKMARK(module->degreeEnabled[degree]);
+		MenuItem::step();
+	}
+};
+
+
+struct DegreeAllItem : MenuItem {
+	Quantizer_MTS_ESP* module;
+	void onAction(const ActionEvent& e) override {
+		for (int i = 0; i < 128; i++)
+			module->degreeEnabled[i] = true;
+		module->noteTablesDirty = true;
+	}
+};
+
+
+struct DegreeItem : MenuItem {
+	Quantizer_MTS_ESP* module;
+	Menu* createChildMenu() override {
+		Menu* menu = new Menu;
+		DegreeAllItem* allItem = new DegreeAllItem;
+		allItem->text = "Enable all";
+		allItem->module = module;
+		menu->addChild(allItem);
+		menu->addChild(new MenuSeparator);
+		for (int i = 0; i < module->mapSize; i++) {
+			DegreeValueItem* item = new DegreeValueItem;
+			item->text = string::f("Degree %d (note %d)", i, (module->mapStartKey + i) % 128);
+			item->module = module;
+			item->degree = i;
+			menu->addChild(item);
+		}
+		return menu;
+	}
+};
+
+
+struct MultiChannelItem : MenuItem {
+	Quantizer_MTS_ESP* module;
+	void onAction(const ActionEvent& e) override {
+		module->multiChannel ^= true;
+		module->noteTablesDirty = true;
+	}
+};
+
+
 struct Quantizer_MTS_ESPWidget : ModuleWidget {
 	Quantizer_MTS_ESPWidget(Quantizer_MTS_ESP* module) {
 		setModule(module);
 		setPanel(APP->window->loadSvg(asset::plugin(pluginInstance, "res/Quantizer_MTS_ESP.svg")));
 
 		addChild(createWidget<ScrewSilver>(Vec(RACK_GRID_WIDTH, 0)));
+		addChild(createWidget<ScrewSilver>(Vec(box.size.x - 2 * RACK_GRID_WIDTH, 0)));
 		addChild(createWidget<ScrewSilver>(Vec(RACK_GRID_WIDTH, RACK_GRID_HEIGHT - RACK_GRID_WIDTH)));
+		addChild(createWidget<ScrewSilver>(Vec(box.size.x - 2 * RACK_GRID_WIDTH, RACK_GRID_HEIGHT - RACK_GRID_WIDTH)));
 		
-		addChild(createLightCentered<SmallLight<GreenLight>>(mm2px(Vec(7.526, 18.)), module, Quantizer_MTS_ESP::CONNECTED_LIGHT));
+		addChild(createLightCentered<SmallLight<GreenLight>>(mm2px(Vec(15.24, 18.)), module, Quantizer_MTS_ESP::CONNECTED_LIGHT));
 
         addParam(createParam<CKSS>(mm2px(Vec(1., 41.59)), module, Quantizer_MTS_ESP::MODE_PARAM));
-		addParam(createParam<CKSSThree>(mm2px(Vec(1., 53.679)), module, Quantizer_MTS_ESP::ROUNDING_PARAM));
+		addParam(createParam<CKSSThree>(mm2px(Vec(16.24, 41.589)), module, Quantizer_MTS_ESP::ROUNDING_PARAM));
 		
 		addInput(createInputCentered<PJ301MPort>(mm2px(Vec(7.526, 73.409)), module, Quantizer_MTS_ESP::CV_IN_INPUT));
+		addInput(createInputCentered<PJ301MPort>(mm2px(Vec(22.766, 73.409)), module, Quantizer_MTS_ESP::CLOCK_INPUT));
 		addOutput(createOutputCentered<PJ301MPort>(mm2px(Vec(7.526, 91.386)), module, Quantizer_MTS_ESP::CV_OUT_OUTPUT));
 		addOutput(createOutputCentered<PJ301MPort>(mm2px(Vec(7.526, 109.34)), module, Quantizer_MTS_ESP::TRIGGER_OUTPUT));
+		addOutput(createOutputCentered<PJ301MPort>(mm2px(Vec(22.766, 91.386)), module, Quantizer_MTS_ESP::NOTE_OUTPUT));
+		addOutput(createOutputCentered<PJ301MPort>(mm2px(Vec(22.766, 109.34)), module, Quantizer_MTS_ESP::DEGREE_OUTPUT));
+	}
+
+	void appendContextMenu(Menu* menu) override {
+		Quantizer_MTS_ESP* module = dynamic_cast<Quantizer_MTS_ESP*>(this->module);
+
+		menu->addChild(new MenuSeparator);
+
+		MultiChannelItem* multiChannelItem = new MultiChannelItem;
+		multiChannelItem->text = "Per-channel tuning";
+		multiChannelItem->rightText = CHECKMARK(module->multiChannel);
+		multiChannelItem->module = module;
+		menu->addChild(multiChannelItem);
+
+		DegreeItem* degreeItem = new DegreeItem;
+		degreeItem->text = "Scale degrees";
+		degreeItem->rightText = RIGHT_ARROW;
+		degreeItem->module = module;
+		menu->addChild(degreeItem);
+
+		HysteresisItem* hysteresisItem = new HysteresisItem;
+		hysteresisItem->text = "Hysteresis";
+		hysteresisItem->rightText = RIGHT_ARROW;
+		hysteresisItem->module = module;
+		menu->addChild(hysteresisItem);
+
+		RateLimitItem* rateLimitItem = new RateLimitItem;
+		rateLimitItem->text = "Low-CPU mode";
+		rateLimitItem->rightText = RIGHT_ARROW;
+		rateLimitItem->module = module;
+		menu->addChild(rateLimitItem);
+
+		MTSClientStatsItem* statsItem = new MTSClientStatsItem;
+		statsItem->text = "MTS-ESP statistics";
+		statsItem->rightText = RIGHT_ARROW;
+		statsItem->mtsClient = module->mtsClient;
+		menu->addChild(statsItem);
 	}
 };
 
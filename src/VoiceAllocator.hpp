@@ -0,0 +1,138 @@
+#pragma once
+#include <cstdint>
+
+
+/** Bookkeeping for up to 16 polyphonic voices.
+Free voices and the voices assigned to each note are kept as bit masks, so finding a free voice or the voices
+playing a note takes a couple of bit operations. Stealing compares at most 16 busy voices.
+*/
+struct VoiceAllocator {
+	enum StealPolicy {
+		// Leave the choice to the caller's allocation mode
+		STEAL_DEFAULT,
+		STEAL_OLDEST,
+		STEAL_QUIETEST,
+		STEAL_LOWEST,
+		STEAL_HIGHEST,
+		// Retrigger a voice already playing the note, otherwise the oldest
+		STEAL_SAME_NOTE,
+		NUM_STEAL_POLICIES
+	};
+
+	int voices = 16;
+	uint16_t busy = 0;
+	// Voices whose last note is n, whether or not they are still busy
+	uint16_t noteVoices[128] = {};
+	uint8_t notes[16] = {};
+	uint8_t velocities[16] = {};
+	// Press order, larger is newer
+	uint32_t ages[16] = {};
+	uint32_t age = 0;
+
+	static int lowestBit(uint32_t mask) {
+		return __builtin_ctz(mask);
+	}
+
+	uint16_t activeMask() const {
+		return (uint16_t) ((1u << voices) - 1);
+	}
+
+	uint16_t freeMask() const {
+		return ~busy & activeMask();
+	}
+
+	/** Frees every voice and points them all at `note` */
+	void reset(int voices, uint8_t note) {
+		this->voices = voices;
+		busy = 0;
+		for (int n = 0; n < 128; n++)
+			noteVoices[n] = 0;
+		for (int v = 0; v < 16; v++) {
+			notes[v] = note;
+			velocities[v] = 0;
+			ages[v] = 0;
+		}
+		noteVoices[note] = 0xffff;
+		age = 0;
+	}
+
+	void setNote(int v, uint8_t note) {
+		noteVoices[notes[v]] &= ~(1 << v);
+		notes[v] = note;
+		noteVoices[note] |= 1 << v;
+	}
+
+	void press(int v, uint8_t velocity) {
+		busy |= 1 << v;
+		velocities[v] = velocity;
+		ages[v] = ++age;
+	}
+
+	void release(int v) {
+		busy &= ~(1 << v);
+	}
+
+	bool isBusy(int v) const {
+		return (busy >> v) & 1;
+	}
+
+	/** Active voices whose last note is `note` */
+	uint16_t withNote(uint8_t note) const {
+		return noteVoices[note & 127] & activeMask();
+	}
+
+	/** The first free voice, or -1 */
+	int firstFree() const {
+		uint16_t mask = freeMask();
+		return mask ? lowestBit(mask) : -1;
+	}
+
+	/** The first free voice after `after`, wrapping around to `after` itself last, or -1 */
+	int nextFree(int after) const {
+		uint32_t mask = freeMask();
+		if (!mask)
+			return -1;
+		uint32_t above = (after >= 0) ? mask & ~((2u << after) - 1) : mask;
+		return lowestBit(above ? above : mask);
+	}
+
+	/** The busy voice to take over for `note`, or -1 for STEAL_DEFAULT */
+	int steal(StealPolicy policy, uint8_t note) const {
+		uint16_t mask = busy & activeMask();
+		if (policy == STEAL_DEFAULT || !mask)
+			return -1;
+		if (policy == STEAL_SAME_NOTE) {
+			uint16_t same = withNote(note) & mask;
+			if (same)
+				return lowestBit(same);
+			policy = STEAL_OLDEST;
+		}
+		int best = -1;
+		for (; mask; mask &= mask - 1) {
+			int v = lowestBit(mask);
+			if (best < 0 || better(policy, v, best))
+				best = v;
+		}
+		return best;
+	}
+
+	/** Whether voice `a` is a better candidate than `b`. Ties go to the older voice. */
+	bool better(StealPolicy policy, int a, int b) const {
+		switch (policy) {
+			case STEAL_QUIETEST:
+				if (velocities[a] != velocities[b])
+					return velocities[a] < velocities[b];
+				break;
+			case STEAL_LOWEST:
+				if (notes[a] != notes[b])
+					return notes[a] < notes[b];
+				break;
+			case STEAL_HIGHEST:
+				if (notes[a] != notes[b])
+					return notes[a] > notes[b];
+				break;
+			default: break;
+		}
+		return ages[a] < ages[b];
+	}
+};
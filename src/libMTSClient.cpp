@@ -9,6 +9,11 @@ THIS SOFTWARE.
 
 #include "libMTSClient.h"
 #include <math.h>
+#include <string.h>
+#include <atomic>
+#include <mutex>
+#include <vector>
+#include <algorithm>
 #if defined(WIN32) || defined(_WIN32) || defined(__WIN32__) || defined(__NT__) || defined(__TOS_WIN__) || defined(_MSC_VER)
 #define MTS_ESP_WIN
 #define WIN32_LEAN_AND_MEAN
@@ -65,6 +70,18 @@ struct mtsclientglobal
         
         for (int i = 0; i < 16; i++)
             multi_channel_esp_retuning[i] = GetMultiChannelTuning ? GetMultiChannelTuning(static_cast<signed char>(i)) : 0;
+        
+        cache.generation = 0;
+        cache.multiChannelMask = 0;
+        for (int i = 0; i < 16; i++)
+            cache.channelGenerations[i] = 0;
+        for (int i = 0; i < 128; i++)
+        {
+            cache.filtered[i] = false;
+            cache.freqs[i] = 1.0 / iet[i];
+            cache.ratios[i] = 1.0;
+            cache.semitones[i] = 0.0;
+        }
     }
     
     inline bool isOnline() const {return esp_retuning && HasMaster && HasMaster();}
@@ -90,6 +107,9 @@ struct mtsclientglobal
     const double *esp_retuning;
     const double *multi_channel_esp_retuning[16];
     
+    // 12-TET cache handed out for a NULL client
+    MTSTuningCache cache;
+    
 #ifdef MTS_ESP_WIN
     void load_lib()
     {
@@ -195,6 +215,103 @@ struct mtsclientglobal
 
 static mtsclientglobal global;
 
+struct mtsclientstats
+{
+    enum
+    {
+        eNoteToFrequency = 0,
+        eRetuningAsRatio,
+        eRetuningInSemitones,
+        eShouldFilterNote,
+        eFrequencyToNote,
+        eTuningGeneration,
+        eCacheHits,
+        eCacheMisses,
+        eLibraryCalls,
+        eFreqToNoteScans,
+        eFreqToNoteScannedNotes,
+        eSysExBytes,
+        eNumCounters
+    };
+    
+    mtsclientstats()
+    {
+        for (int i = 0; i < eNumCounters; i++)
+            counters[i].store(0, std::memory_order_relaxed);
+    }
+    
+    // A client is only ever queried from one thread at a time, so counters are accumulated with a relaxed load and store
+    // rather than a locked read-modify-write. Readers on other threads may see slightly stale values.
+    inline void add(int counter, unsigned long long n = 1)
+    {
+        counters[counter].store(counters[counter].load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+    
+    void addTo(unsigned long long *totals) const
+    {
+        for (int i = 0; i < eNumCounters; i++)
+            totals[i] += counters[i].load(std::memory_order_relaxed);
+    }
+    
+    static void toStruct(const unsigned long long *totals, MTSClientStats *s)
+    {
+        s->noteToFrequencyQueries = totals[eNoteToFrequency];
+        s->retuningAsRatioQueries = totals[eRetuningAsRatio];
+        s->retuningInSemitonesQueries = totals[eRetuningInSemitones];
+        s->shouldFilterNoteQueries = totals[eShouldFilterNote];
+        s->frequencyToNoteQueries = totals[eFrequencyToNote];
+        s->tuningGenerationQueries = totals[eTuningGeneration];
+        s->cacheHits = totals[eCacheHits];
+        s->cacheMisses = totals[eCacheMisses];
+        s->libraryCalls = totals[eLibraryCalls];
+        s->frequencyToNoteScans = totals[eFreqToNoteScans];
+        s->frequencyToNoteScannedNotes = totals[eFreqToNoteScannedNotes];
+        s->sysExBytesParsed = totals[eSysExBytes];
+    }
+    
+    std::atomic<unsigned long long> counters[eNumCounters];
+};
+
+// Process-wide statistics are the sum over live clients plus the totals of clients that have been deregistered.
+struct mtsclientstatsregistry
+{
+    mtsclientstatsregistry()
+    {
+        for (int i = 0; i < mtsclientstats::eNumCounters; i++)
+            retired[i] = 0;
+    }
+    
+    void add(const mtsclientstats *stats)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        clients.push_back(stats);
+    }
+    
+    void remove(const mtsclientstats *stats)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stats->addTo(retired);
+        clients.erase(std::remove(clients.begin(), clients.end(), stats), clients.end());
+    }
+    
+    void get(MTSClientStats *s)
+    {
+        unsigned long long totals[mtsclientstats::eNumCounters];
+        std::lock_guard<std::mutex> lock(mutex);
+        for (int i = 0; i < mtsclientstats::eNumCounters; i++)
+            totals[i] = retired[i];
+        for (size_t i = 0; i < clients.size(); i++)
+            clients[i]->addTo(totals);
+        mtsclientstats::toStruct(totals, s);
+    }
+    
+    std::mutex mutex;
+    std::vector<const mtsclientstats*> clients;
+    unsigned long long retired[mtsclientstats::eNumCounters];
+};
+
+static mtsclientstatsregistry statsRegistry;
+
 struct MTSClient
 {
     struct Tuning
@@ -217,6 +334,17 @@ struct MTSClient
     , supportsMultiChannelTuning(false)
     , freqRequestReceived(false)
     , receivedMTSSysEx(false)
+    , generation(0)
+    , generationOnline(false)
+    , generationLocalChanged(false)
+    , generationMultiChannels(0)
+    , generationFilterPos(0)
+    , generationChannelFilterPos(0)
+    , generationFilterScan(0)
+    , generationChannelScans(0)
+    , generationChannelScan(0)
+    , generationChannelScanPos(0)
+    , generationPendingChannels(0)
     {
         for (int i = 0; i < 128; i++)
         {
@@ -233,37 +361,80 @@ struct MTSClient
             {
                 globalMultichannelTunings[i][j].flags = 0;
                 globalMultichannelTunings[i][j].freq = localFreqs[i];
+                generationMultiChannelFreqs[i][j] = 0.0;
+                generationMultiChannelFiltered[i][j] = false;
             }
         }
+        
+        for (int i = 0; i < 128; i++)
+        {
+            generationFreqs[i] = 0.0;
+            generationFiltered[i] = false;
+        }
+        updateCache(false, 0xffff);
                 
         if (global.RegisterClient)
             global.RegisterClient();
+        
+        statsRegistry.add(&stats);
     }
     
     ~MTSClient()
     {
+        statsRegistry.remove(&stats);
+        
         if (global.DeregisterClient)
             global.DeregisterClient();
     }
     
-    inline bool hasMaster() {return global.isOnline();}
+    // Calls into libMTS, counted for statistics
+    inline bool isOnline()
+    {
+        if (!global.esp_retuning || !global.HasMaster)
+            return false;
+        stats.add(mtsclientstats::eLibraryCalls);
+        return global.HasMaster();
+    }
+    inline bool useMultiChannelTuning(signed char midichannel)
+    {
+        if (!global.UseMultiChannelTuning)
+            return false;
+        stats.add(mtsclientstats::eLibraryCalls);
+        return global.UseMultiChannelTuning(midichannel);
+    }
+    inline bool libShouldFilterNote(char midinote, signed char midichannel)
+    {
+        if (!global.ShouldFilterNote)
+            return false;
+        stats.add(mtsclientstats::eLibraryCalls);
+        return global.ShouldFilterNote(midinote, midichannel);
+    }
+    inline bool libShouldFilterNoteMultiChannel(char midinote, signed char midichannel)
+    {
+        if (!global.ShouldFilterNoteMultiChannel)
+            return false;
+        stats.add(mtsclientstats::eLibraryCalls);
+        return global.ShouldFilterNoteMultiChannel(midinote, midichannel);
+    }
+    
+    inline bool hasMaster() {return isOnline();}
     inline bool shouldUpdateLibrary() {return global.GetVersionNumber ? (global.GetVersionNumber() < libMTSVersion) : false;}
     
     inline double freq(char midinote, signed char midichannel)
     {
+        stats.add(mtsclientstats::eNoteToFrequency);
         int note = midinote & 127;
         int channel = midichannel & 15;
         
         freqRequestReceived = true;
         supportsMultiChannelTuning = !(midichannel & ~15);
         
-        if (!global.isOnline())
+        if (!isOnline())
             return localTunings[note].freq;
         
         if ((!supportsNoteFiltering || supportsMultiChannelNoteFiltering) &&
             supportsMultiChannelTuning &&
-            global.UseMultiChannelTuning &&
-            global.UseMultiChannelTuning(midichannel) &&
+            useMultiChannelTuning(midichannel) &&
             global.multi_channel_esp_retuning[channel])
         {
             globalMultichannelTunings[channel][note].freq = global.multi_channel_esp_retuning[channel][note];
@@ -278,20 +449,25 @@ struct MTSClient
     
     inline double ratio(char midinote, signed char midichannel)
     {
+        stats.add(mtsclientstats::eRetuningAsRatio);
         int note = midinote & 127;
         int channel = midichannel & 15;
         
         freqRequestReceived = true;
         supportsMultiChannelTuning = !(midichannel & ~15);
         
-        if (!global.isOnline())
+        if (!isOnline())
         {
             if (!receivedMTSSysEx)
                 return 1.0;
             
             if (localTunings[note].flags & Tuning::eRatioValid)
+            {
+                stats.add(mtsclientstats::eCacheHits);
                 return localTunings[note].ratio;
+            }
             
+            stats.add(mtsclientstats::eCacheMisses);
             localTunings[note].ratio = localTunings[note].freq * global.iet[note];
             localTunings[note].flags |= Tuning::eRatioValid;
             return localTunings[note].ratio;
@@ -299,8 +475,7 @@ struct MTSClient
         
         if ((!supportsNoteFiltering || supportsMultiChannelNoteFiltering) &&
             supportsMultiChannelTuning &&
-            global.UseMultiChannelTuning &&
-            global.UseMultiChannelTuning(midichannel) &&
+            useMultiChannelTuning(midichannel) &&
             global.multi_channel_esp_retuning[channel])
         {
             double freq = global.multi_channel_esp_retuning[channel][note];
@@ -308,9 +483,11 @@ struct MTSClient
             if (globalMultichannelTunings[channel][note].freq == freq &&
                 (globalMultichannelTunings[channel][note].flags & Tuning::eRatioValid))
             {
+                stats.add(mtsclientstats::eCacheHits);
                 return globalMultichannelTunings[channel][note].ratio;
             }
             
+            stats.add(mtsclientstats::eCacheMisses);
             globalMultichannelTunings[channel][note].freq = global.multi_channel_esp_retuning[channel][note];
             globalMultichannelTunings[channel][note].ratio = globalMultichannelTunings[channel][note].freq * global.iet[note];
             globalMultichannelTunings[channel][note].flags = Tuning::eRatioValid;
@@ -322,9 +499,11 @@ struct MTSClient
         if (globalTunings[note].freq == freq &&
             (globalTunings[note].flags & Tuning::eRatioValid))
         {
+            stats.add(mtsclientstats::eCacheHits);
             return globalTunings[note].ratio;
         }
         
+        stats.add(mtsclientstats::eCacheMisses);
         globalTunings[note].freq = global.esp_retuning[note];
         globalTunings[note].ratio = globalTunings[note].freq * global.iet[note];
         globalTunings[note].flags = Tuning::eRatioValid;
@@ -333,20 +512,25 @@ struct MTSClient
     
     inline double semitones(char midinote, signed char midichannel)
     {
+        stats.add(mtsclientstats::eRetuningInSemitones);
         int note = midinote & 127;
         int channel = midichannel & 15;
         
         freqRequestReceived = true;
         supportsMultiChannelTuning = !(midichannel & ~15);
         
-        if (!global.isOnline())
+        if (!isOnline())
         {
             if (!receivedMTSSysEx)
                 return 0.0;
             
             if (localTunings[note].flags & Tuning::eSemitonesValid)
+            {
+                stats.add(mtsclientstats::eCacheHits);
                 return localTunings[note].semitones;
+            }
             
+            stats.add(mtsclientstats::eCacheMisses);
             if (localTunings[note].flags & Tuning::eRatioValid)
             {
                 localTunings[note].semitones = ratioToSemitones * log(localTunings[note].ratio);
@@ -362,8 +546,7 @@ struct MTSClient
         
         if ((!supportsNoteFiltering || supportsMultiChannelNoteFiltering) &&
             supportsMultiChannelTuning &&
-            global.UseMultiChannelTuning &&
-            global.UseMultiChannelTuning(midichannel) &&
+            useMultiChannelTuning(midichannel) &&
             global.multi_channel_esp_retuning[channel])
         {
             double freq = global.multi_channel_esp_retuning[channel][note];
@@ -371,16 +554,21 @@ struct MTSClient
             if (globalMultichannelTunings[channel][note].freq == freq)
             {
                 if (globalMultichannelTunings[channel][note].flags & Tuning::eSemitonesValid)
+                {
+                    stats.add(mtsclientstats::eCacheHits);
                     return globalMultichannelTunings[channel][note].semitones;
+                }
                 
                 if (globalMultichannelTunings[channel][note].flags & Tuning::eRatioValid)
                 {
+                    stats.add(mtsclientstats::eCacheMisses);
                     globalMultichannelTunings[channel][note].semitones = ratioToSemitones * log(globalMultichannelTunings[channel][note].ratio);
                     globalMultichannelTunings[channel][note].flags |= Tuning::eSemitonesValid;
                     return globalMultichannelTunings[channel][note].semitones;
                 }
             }
             
+            stats.add(mtsclientstats::eCacheMisses);
             globalMultichannelTunings[channel][note].freq = freq;
             globalMultichannelTunings[channel][note].ratio = freq * global.iet[note];
             globalMultichannelTunings[channel][note].semitones = ratioToSemitones * log(globalMultichannelTunings[channel][note].ratio);
@@ -393,16 +581,21 @@ struct MTSClient
         if (globalTunings[note].freq == freq)
         {
             if (globalTunings[note].flags & Tuning::eSemitonesValid)
+            {
+                stats.add(mtsclientstats::eCacheHits);
                 return globalTunings[note].semitones;
+            }
             
             if (globalTunings[note].flags & Tuning::eRatioValid)
             {
+                stats.add(mtsclientstats::eCacheMisses);
                 globalTunings[note].semitones = ratioToSemitones * log(globalTunings[note].ratio);
                 globalTunings[note].flags |= Tuning::eSemitonesValid;
                 return globalTunings[note].semitones;
             }
         }
         
+        stats.add(mtsclientstats::eCacheMisses);
         globalTunings[note].freq = freq;
         globalTunings[note].ratio = freq * global.iet[note];
         globalTunings[note].semitones = ratioToSemitones * log(globalTunings[note].ratio);
@@ -412,36 +605,38 @@ struct MTSClient
     
     inline bool shouldFilterNote(char midinote, signed char midichannel)
     {
+        stats.add(mtsclientstats::eShouldFilterNote);
         supportsNoteFiltering = true;
         supportsMultiChannelNoteFiltering = !(midichannel & ~15);
         
         if (!freqRequestReceived)
             supportsMultiChannelTuning = supportsMultiChannelNoteFiltering; // assume it supports multi channel tuning until a request is received for a frequency and can verify
         
-        if (!global.isOnline())
+        if (!isOnline())
             return false;
         
         if (supportsMultiChannelNoteFiltering &&
             supportsMultiChannelTuning &&
-            global.UseMultiChannelTuning &&
-            global.UseMultiChannelTuning(midichannel))
+            useMultiChannelTuning(midichannel))
         {
-            return global.ShouldFilterNoteMultiChannel ? global.ShouldFilterNoteMultiChannel(midinote & 127, midichannel) : false;
+            return libShouldFilterNoteMultiChannel(midinote & 127, midichannel);
         }
         
-        return global.ShouldFilterNote ? global.ShouldFilterNote(midinote & 127, midichannel) : false;
+        return libShouldFilterNote(midinote & 127, midichannel);
     }
     
     inline char freqToNote(double freq, signed char midichannel)
     {
-        bool online = global.isOnline();
+        stats.add(mtsclientstats::eFrequencyToNote);
+        stats.add(mtsclientstats::eFreqToNoteScans);
+        stats.add(mtsclientstats::eFreqToNoteScannedNotes, 128);
+        bool online = isOnline();
         bool multiChannel = false;
         const double *freqs = online ? global.esp_retuning : localFreqs;
         
         if (online &&
             !(midichannel & ~15) &&
-            global.UseMultiChannelTuning &&
-            global.UseMultiChannelTuning(midichannel) &&
+            useMultiChannelTuning(midichannel) &&
             global.multi_channel_esp_retuning[midichannel & 15])
         {
             freqs = global.multi_channel_esp_retuning[midichannel & 15];
@@ -458,15 +653,13 @@ struct MTSClient
             if (online)
             {
                 if (multiChannel && 
-                    global.ShouldFilterNoteMultiChannel &&
-                    global.ShouldFilterNoteMultiChannel(static_cast<char>(i), midichannel))
+                    libShouldFilterNoteMultiChannel(static_cast<char>(i), midichannel))
                 {
                     continue;
                 }
                 
                 if (!multiChannel &&
-                    global.ShouldFilterNote &&
-                    global.ShouldFilterNote(static_cast<char>(i), midichannel))
+                    libShouldFilterNote(static_cast<char>(i), midichannel))
                 {
                     continue;
                 }
@@ -507,17 +700,20 @@ struct MTSClient
         if (!midichannel) 
             return freqToNote(freq, static_cast<signed char>(-1));
         
-        if (global.isOnline() && global.UseMultiChannelTuning)
+        if (isOnline() && global.UseMultiChannelTuning)
         {
             int channelsInUse[16];
             int nMultiChannels = 0;
             for (int i = 0; i < 16; i++)
-                if (global.UseMultiChannelTuning(i) && global.multi_channel_esp_retuning[i])
+                if (useMultiChannelTuning(static_cast<signed char>(i)) && global.multi_channel_esp_retuning[i])
                     channelsInUse[nMultiChannels++] = i;
             
             if (nMultiChannels > 0)
             {
                 const int nFreqs = 128 * nMultiChannels;
+                stats.add(mtsclientstats::eFrequencyToNote);
+                stats.add(mtsclientstats::eFreqToNoteScans);
+                stats.add(mtsclientstats::eFreqToNoteScannedNotes, nFreqs);
                 int iLower = 0;
                 int iUpper = 0;
                 int channel = 0;
@@ -530,8 +726,7 @@ struct MTSClient
                     channel = channelsInUse[i >> 7];
                     note = i & 127;
                     
-                    if (global.ShouldFilterNoteMultiChannel &&
-                        global.ShouldFilterNoteMultiChannel(static_cast<char>(note), static_cast<signed char>(channel)))
+                    if (libShouldFilterNoteMultiChannel(static_cast<char>(note), static_cast<signed char>(channel)))
                     {
                         continue;
                     }
@@ -592,6 +787,9 @@ struct MTSClient
     
     inline void parseMIDIData(const unsigned char *buffer, int len)
     {
+        if (len > 0)
+            stats.add(mtsclientstats::eSysExBytes, static_cast<unsigned long long>(len));
+        
         int sysex_ctr = 0;
         int sysex_value = 0;
         int note = 0;
@@ -824,14 +1022,186 @@ struct MTSClient
         {
             localTunings[note].freq = localFreqs[note];
             localTunings[note].flags = 0;
+            generationLocalChanged = true;
+        }
+    }
+    
+    // Compares the tables in use against the snapshot taken on the previous call and increments the generation if anything
+    // changed, refreshing the tuning cache. Note filtering costs a library call per note, so at most
+    // filterQueriesPerCall notes are checked per call: a retuned table has its filtering rescanned over several calls, and
+    // its channels are only reported changed once the rescan is complete. With no rescan due, a few notes of channel -1
+    // and of the multi-channel tables are sampled per call, so a filter change on its own is picked up within 16 calls,
+    // or within 16 calls per multi-channel table for the filtering of those channels.
+    inline unsigned int tuningGeneration()
+    {
+        stats.add(mtsclientstats::eTuningGeneration);
+        bool online = isOnline();
+        bool changed = online != generationOnline || generationLocalChanged;
+        generationOnline = online;
+        generationLocalChanged = false;
+        // bit n set if what channel n returns may have changed
+        int changedChannels = changed ? 0xffff : 0;
+        
+        if (online)
+        {
+            if (memcmp(generationFreqs, global.esp_retuning, sizeof(generationFreqs)))
+            {
+                memcpy(generationFreqs, global.esp_retuning, sizeof(generationFreqs));
+                changedChannels |= ~generationMultiChannels & 0xffff;
+            }
+            
+            int multiChannels = 0;
+            if (global.UseMultiChannelTuning)
+            {
+                for (int i = 0; i < 16; i++)
+                    if (useMultiChannelTuning(static_cast<signed char>(i)) && global.multi_channel_esp_retuning[i])
+                        multiChannels |= 1 << i;
+            }
+            if (multiChannels != generationMultiChannels)
+            {
+                changedChannels |= multiChannels ^ generationMultiChannels;
+                generationMultiChannels = multiChannels;
+            }
+            for (int i = 0; i < 16; i++)
+            {
+                if (!(multiChannels & (1 << i)))
+                    continue;
+                if (memcmp(generationMultiChannelFreqs[i], global.multi_channel_esp_retuning[i], sizeof(generationMultiChannelFreqs[i])))
+                {
+                    memcpy(generationMultiChannelFreqs[i], global.multi_channel_esp_retuning[i], sizeof(generationMultiChannelFreqs[i]));
+                    changedChannels |= 1 << i;
+                }
+            }
+            
+            // rescan a table's whole filter when its tuning changed, since mapping changes usually come with it. A rescan
+            // under way just carries on, so a table that keeps changing is still reported once per rescan.
+            if ((changedChannels & ~multiChannels & 0xffff) && !generationFilterScan)
+                generationFilterScan = 128;
+            generationChannelScans = (generationChannelScans | (changedChannels & multiChannels)) & multiChannels;
+            generationPendingChannels |= changedChannels;
+            
+            int budget = filterQueriesPerCall;
+            int nFilterNotes = generationFilterScan ? std::min(generationFilterScan, budget) : 8;
+            for (int i = 0; i < nFilterNotes; i++)
+            {
+                int note = generationFilterPos;
+                generationFilterPos = (generationFilterPos + 1) & 127;
+                bool filtered = libShouldFilterNote(static_cast<char>(note), static_cast<signed char>(-1));
+                if (filtered != generationFiltered[note])
+                {
+                    generationFiltered[note] = filtered;
+                    // channels without their own table are assumed to be filtered like channel -1
+                    generationPendingChannels = 0xffff;
+                }
+            }
+            if (generationFilterScan)
+            {
+                generationFilterScan -= nFilterNotes;
+                budget -= nFilterNotes;
+            }
+            
+            // channels with their own table may be filtered differently, so rescan the retuned ones a channel at a time
+            while (budget > 0 && generationChannelScans)
+            {
+                if (!(generationChannelScans & (1 << generationChannelScan)))
+                {
+                    generationChannelScan = __builtin_ctz(generationChannelScans);
+                    generationChannelScanPos = 0;
+                }
+                int n = std::min(budget, 128 - generationChannelScanPos);
+                for (int i = 0; i < n; i++)
+                    sampleChannelFilter(generationChannelScanPos++, generationChannelScan);
+                budget -= n;
+                if (generationChannelScanPos == 128)
+                    generationChannelScans &= ~(1 << generationChannelScan);
+            }
+            
+            // and otherwise sample them like channel -1
+            if (multiChannels && !generationChannelScans)
+            {
+                for (int i = 0; i < 8; i++)
+                {
+                    while (!(multiChannels & (1 << (generationChannelFilterPos >> 7))))
+                        generationChannelFilterPos = (((generationChannelFilterPos >> 7) + 1) & 15) << 7;
+                    int channel = generationChannelFilterPos >> 7;
+                    int note = generationChannelFilterPos & 127;
+                    generationChannelFilterPos = (generationChannelFilterPos + 1) & 2047;
+                    sampleChannelFilter(note, channel);
+                }
+            }
+        }
+        else
+        {
+            generationFilterScan = 0;
+            generationChannelScans = 0;
+            generationPendingChannels |= changedChannels;
+        }
+        
+        // report channels whose rescan is complete. The cache holds channel -1, so nothing is reported while it is
+        // being rescanned.
+        int readyChannels = generationFilterScan ? 0 : generationPendingChannels & ~generationChannelScans;
+        if (readyChannels)
+        {
+            generationPendingChannels &= ~readyChannels;
+            generation++;
+            updateCache(online, readyChannels);
+        }
+        return generation;
+    }
+    
+    // Compares the filtering of a note on a channel with its own table against the snapshot, as shouldFilterNote() would
+    // query it, and marks the channel pending if it differs
+    inline void sampleChannelFilter(int note, int channel)
+    {
+        bool filtered = (supportsMultiChannelNoteFiltering && supportsMultiChannelTuning) ?
+            libShouldFilterNoteMultiChannel(static_cast<char>(note), static_cast<signed char>(channel)) :
+            libShouldFilterNote(static_cast<char>(note), static_cast<signed char>(channel));
+        if (filtered != generationMultiChannelFiltered[channel][note])
+        {
+            generationMultiChannelFiltered[channel][note] = filtered;
+            generationPendingChannels |= 1 << channel;
         }
     }
     
+    // Fills the cache with what channel -1 queries would return for the current tuning, and stamps the channels in
+    // changedChannels with the current generation
+    void updateCache(bool online, int changedChannels)
+    {
+        for (int i = 0; i < 128; i++)
+        {
+            double freq = online ? generationFreqs[i] : localTunings[i].freq;
+            cache.freqs[i] = freq;
+            if (online || receivedMTSSysEx)
+            {
+                cache.ratios[i] = freq * global.iet[i];
+                cache.semitones[i] = ratioToSemitones * log(cache.ratios[i]);
+            }
+            else
+            {
+                cache.ratios[i] = 1.0;
+                cache.semitones[i] = 0.0;
+            }
+            cache.filtered[i] = online && generationFiltered[i];
+        }
+        cache.multiChannelMask = online ? static_cast<unsigned short>(generationMultiChannels) : 0;
+        cache.generation = generation;
+        for (int i = 0; i < 16; i++)
+            if (changedChannels & (1 << i))
+                cache.channelGenerations[i] = generation;
+    }
+    
     inline bool hasReceivedMTSSysEx() {return receivedMTSSysEx;}
     
-    const char *getScaleName() {return (global.isOnline() && global.GetScaleName) ? global.GetScaleName() : tuningName;}
+    void getStats(MTSClientStats *s) const
+    {
+        unsigned long long totals[mtsclientstats::eNumCounters] = {0};
+        stats.addTo(totals);
+        mtsclientstats::toStruct(totals, s);
+    }
+    
+    const char *getScaleName() {return (isOnline() && global.GetScaleName) ? (stats.add(mtsclientstats::eLibraryCalls), global.GetScaleName()) : tuningName;}
     
-    double getPeriodRatio() {return (global.isOnline() && global.GetPeriodRatio) ? global.GetPeriodRatio() : 2.0;}
+    double getPeriodRatio() {return (isOnline() && global.GetPeriodRatio) ? (stats.add(mtsclientstats::eLibraryCalls), global.GetPeriodRatio()) : 2.0;}
     double getPeriodSemitones()
     {
         double periodRatio = getPeriodRatio();
@@ -843,9 +1213,9 @@ struct MTSClient
         return periodSemitones;
     }
     
-    signed char getMapSize() {return (global.isOnline() && global.GetMapSize) ? global.GetMapSize() : mapSizeLocal;}
-    signed char getMapStartKey() {return (global.isOnline() && global.GetMapStartKey) ? global.GetMapStartKey() : mapStartKeyLocal;}
-    signed char getRefKey() {return (global.isOnline() && global.GetRefKey) ? global.GetRefKey() : static_cast<signed char>(-1);}
+    signed char getMapSize() {return (isOnline() && global.GetMapSize) ? (stats.add(mtsclientstats::eLibraryCalls), global.GetMapSize()) : mapSizeLocal;}
+    signed char getMapStartKey() {return (isOnline() && global.GetMapStartKey) ? (stats.add(mtsclientstats::eLibraryCalls), global.GetMapStartKey()) : mapStartKeyLocal;}
+    signed char getRefKey() {return (isOnline() && global.GetRefKey) ? (stats.add(mtsclientstats::eLibraryCalls), global.GetRefKey()) : static_cast<signed char>(-1);}
     
     enum eSysexState {eIgnoring = 0, eMatchingSysex, eSysexValid, eMatchingMTS, eMatchingBank, eMatchingProg, eMatchingChannel, eTuningName, eNumTunings, eTuningData, eCheckSum};
     enum eMTSFormat {eRequest = 0, eBulk, eSingle, eScaleOctOneByte, eScaleOctTwoByte, eScaleOctOneByteExt, eScaleOctTwoByteExt};
@@ -868,6 +1238,30 @@ struct MTSClient
     bool supportsMultiChannelTuning;
     bool freqRequestReceived;
     bool receivedMTSSysEx;
+    
+    // tuning change detection
+    unsigned int generation;
+    bool generationOnline;
+    bool generationLocalChanged;
+    int generationMultiChannels;
+    int generationFilterPos;
+    int generationChannelFilterPos;
+    // notes of channel -1 left to rescan, multi-channel tables to rescan, the one being rescanned and its next note
+    int generationFilterScan;
+    int generationChannelScans;
+    int generationChannelScan;
+    int generationChannelScanPos;
+    // channels that changed but are not reported until their rescan is complete
+    int generationPendingChannels;
+    // library filter queries one tuningGeneration() call may make for rescans
+    static const int filterQueriesPerCall = 32;
+    double generationFreqs[128];
+    double generationMultiChannelFreqs[16][128];
+    bool generationFiltered[128];
+    bool generationMultiChannelFiltered[16][128];
+    MTSTuningCache cache;
+    
+    mtsclientstats stats;
 };
 
 static char freqToNoteET(double freq)
@@ -906,3 +1300,7 @@ signed char MTS_GetRefKey(MTSClient *c)
 void MTS_ParseMIDIDataU(MTSClient *c, const unsigned char *buffer, int len)             {if (c) c->parseMIDIData(buffer, len);}
 void MTS_ParseMIDIData(MTSClient *c, const signed char *buffer, int len)                {if (c) c->parseMIDIData(reinterpret_cast<const unsigned char*>(buffer), len);}
 bool MTS_HasReceivedMTSSysEx(MTSClient *c)                                              {return c ? c->hasReceivedMTSSysEx() : false;}
+unsigned int MTS_GetTuningGeneration(MTSClient *c)                                      {return c ? c->tuningGeneration() : 0;}
+void MTS_GetClientStats(MTSClient *c, MTSClientStats *stats)                            {if (c && stats) c->getStats(stats); else if (stats) memset(stats, 0, sizeof(*stats));}
+void MTS_GetProcessStats(MTSClientStats *stats)                                         {if (stats) statsRegistry.get(stats);}
+const MTSTuningCache *MTS_GetTuningCache(MTSClient *c)                                  {return c ? &c->cache : &global.cache;}
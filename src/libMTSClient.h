@@ -182,6 +182,48 @@ extern "C" {
     // Check if the client has received any valid MTS SysEx messages and will use local tuning if not connected to a master plug-in.
     extern bool MTS_HasReceivedMTSSysEx(MTSClient *client);
 
+    // Returns a counter which is incremented whenever the tuning seen by the client changes: a master connects or disconnects,
+    // the global or a multi-channel tuning table is modified, note filtering changes or MTS SysEx retunes the local table.
+    // Cheap enough to poll at control rate; re-query cached retuning only when the returned value changes.
+    extern unsigned int MTS_GetTuningGeneration(MTSClient *client);
+
+    // Query statistics, cumulative since a client registered (per client) or since the library was loaded (process-wide).
+    // Counters are kept per client by the thread querying it and are cheap enough to leave enabled; values read from another
+    // thread may lag slightly behind.
+    typedef struct MTSClientStats
+    {
+        unsigned long long noteToFrequencyQueries;
+        unsigned long long retuningAsRatioQueries;
+        unsigned long long retuningInSemitonesQueries;
+        unsigned long long shouldFilterNoteQueries;
+        unsigned long long frequencyToNoteQueries;
+        unsigned long long tuningGenerationQueries;
+        unsigned long long cacheHits;               // ratio/semitone lookups served from the client's cache
+        unsigned long long cacheMisses;             // ratio/semitone lookups which had to be recomputed
+        unsigned long long libraryCalls;            // calls into the libMTS dynamic library
+        unsigned long long frequencyToNoteScans;    // linear scans of a tuning table by MTS_FrequencyToNote(AndChannel)
+        unsigned long long frequencyToNoteScannedNotes;
+        unsigned long long sysExBytesParsed;
+    } MTSClientStats;
+    extern void MTS_GetClientStats(MTSClient *client, MTSClientStats *stats);
+    extern void MTS_GetProcessStats(MTSClientStats *stats);
+
+    // Snapshot of what channel -1 queries return, refreshed by MTS_GetTuningGeneration() whenever it detects a change and
+    // stamped with the generation it belongs to. Reading it directly avoids a call per query; see libMTSClientCache.hpp for
+    // inline accessors which fall back to the functions above for multi-channel lookups. The pointer is valid for the
+    // lifetime of the client and is never NULL.
+    typedef struct MTSTuningCache
+    {
+        unsigned int generation;
+        unsigned short multiChannelMask; // bit n set if channel n uses a multi-channel table, which the cache does not hold
+        bool filtered[128];
+        double freqs[128];
+        double ratios[128];
+        double semitones[128];
+        unsigned int channelGenerations[16]; // generation at which what channel n returns last changed
+    } MTSTuningCache;
+    extern const MTSTuningCache *MTS_GetTuningCache(MTSClient *client);
+
 #ifdef __cplusplus
 }
 #endif
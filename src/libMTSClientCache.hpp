@@ -0,0 +1,70 @@
+#pragma once
+#include "libMTSClient.h"
+
+/*
+Inline fast path for MTS-ESP queries.
+
+Reads the client's MTSTuningCache (see MTS_GetTuningCache()) instead of crossing into libMTSClient.cpp for every
+query. The cache holds the tuning as of the last MTS_GetTuningGeneration() call, so poll that at control rate as usual.
+Lookups the cache cannot answer, i.e. a specific MIDI channel which the master maps to a multi-channel table, fall back
+to the out-of-line functions. Inline hits are not included in the client statistics.
+
+	const MTSTuningCache* cache = MTS_GetTuningCache(client);
+	double semitones = MTS_CachedRetuning<MTS_SEMITONES>(client, cache, note);
+	double freq = MTS_CachedRetuning<MTS_FREQUENCY, MTS_PER_CHANNEL>(client, cache, note, channel);
+*/
+
+/** Whether a lookup is for a specific MIDI channel, which may be mapped to a multi-channel table, or for channel -1 */
+enum MTSChannelMode {
+	MTS_ANY_CHANNEL,
+	MTS_PER_CHANNEL
+};
+
+enum MTSRepresentation {
+	MTS_FREQUENCY,
+	MTS_RATIO,
+	MTS_SEMITONES
+};
+
+template <MTSRepresentation R>
+struct MTSCacheTable;
+
+template <>
+struct MTSCacheTable<MTS_FREQUENCY> {
+	static const double* get(const MTSTuningCache* cache) {return cache->freqs;}
+	static double query(MTSClient* client, char note, signed char channel) {return MTS_NoteToFrequency(client, note, channel);}
+};
+
+template <>
+struct MTSCacheTable<MTS_RATIO> {
+	static const double* get(const MTSTuningCache* cache) {return cache->ratios;}
+	static double query(MTSClient* client, char note, signed char channel) {return MTS_RetuningAsRatio(client, note, channel);}
+};
+
+template <>
+struct MTSCacheTable<MTS_SEMITONES> {
+	static const double* get(const MTSTuningCache* cache) {return cache->semitones;}
+	static double query(MTSClient* client, char note, signed char channel) {return MTS_RetuningInSemitones(client, note, channel);}
+};
+
+template <MTSChannelMode M>
+inline bool MTS_CacheMiss(const MTSTuningCache* cache, int channel) {
+	if (M == MTS_ANY_CHANNEL)
+		return false;
+	return channel >= 0 && channel < 16 && (cache->multiChannelMask & (1 << channel));
+}
+
+template <MTSRepresentation R, MTSChannelMode M = MTS_ANY_CHANNEL>
+inline double MTS_CachedRetuning(MTSClient* client, const MTSTuningCache* cache, int note, int channel = -1) {
+	if (MTS_CacheMiss<M>(cache, channel))
+		return MTSCacheTable<R>::query(client, note, channel);
+	return MTSCacheTable<R>::get(cache)[note & 127];
+}
+
+/** Masters may filter notes per channel even without multi-channel tables, so only channel -1 filtering is cached */
+template <MTSChannelMode M = MTS_ANY_CHANNEL>
+inline bool MTS_CachedShouldFilterNote(MTSClient* client, const MTSTuningCache* cache, int note, int channel = -1) {
+	if (M == MTS_PER_CHANNEL && channel >= 0)
+		return MTS_ShouldFilterNote(client, note, channel);
+	return cache->filtered[note & 127];
+}